@@ -9,16 +9,19 @@
 #include "actions.h"
 
 #include "dyuv.h"
+#include "encoder_pool.h"
 #include "helper.h"
 
+#include <thread>
+
 using namespace cd_i;
 
 namespace fs = boost::filesystem;
 
 int print_filesystem(std::string input_path, std::string /*output_path*/,
-                     const action_options & /*opts*/) {
+                     const action_options &opts) {
   try {
-    cdi_helper worker(input_path);
+    cdi_helper worker(input_path, "", opts.reader);
     worker.read_disc_paths();
     for (const auto &path : worker.disc_paths()) {
       std::cout << "/" << path << std::endl;
@@ -27,6 +30,7 @@ int print_filesystem(std::string input_path, std::string /*output_path*/,
 
       std::cout << std::endl;
     }
+    worker.report_skipped_data();
   } catch (std::exception &ex) {
     std::cerr << ex.what() << std::endl;
     return 1;
@@ -35,29 +39,47 @@ int print_filesystem(std::string input_path, std::string /*output_path*/,
 }
 
 int copy_filesystem(std::string input_path, std::string output_path,
-                    const action_options & /*opts*/) {
+                    const action_options &opts) {
   try {
-    cdi_helper worker(input_path, output_path);
+    cdi_helper worker(input_path, output_path, opts.reader);
     worker.read_disc_paths();
     worker.init_destination();
 
-    for (const auto &path : worker.disc_paths()) {
-      std::cout << "/" << path << std::endl;
-
-      fs::path subdirectory = worker.init_destination(path);
-
-      worker.enum_directory(path, [&](const std::string &name,
-                                      const directory_entry &file,
-                                      const directory_entry_ex &file_ex) {
-        fs::path destination = subdirectory;
-        destination.append(name);
+    const unsigned int threads =
+        opts.threads ? opts.threads
+                     : std::max(1u, std::thread::hardware_concurrency());
+    worker.copy_files(threads);
+    worker.report_skipped_data();
+  } catch (std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
-        std::cerr << "    Copying " << destination.string() << std::endl;
-        worker.reader().copy_file(file, file_ex, destination.string());
-      });
+int copy_mpeg_streams(std::string input_path, std::string output_path,
+                      const action_options &opts) {
+  try {
+    cdi_helper worker(input_path, output_path, opts.reader);
+    worker.read_disc_paths();
+    worker.init_destination();
+    worker.copy_mpeg_streams();
+    worker.report_skipped_data();
+  } catch (std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
-      std::cout << std::endl;
-    }
+int copy_adpcm_audio(std::string input_path, std::string output_path,
+                     const action_options &opts) {
+  try {
+    cdi_helper worker(input_path, output_path, opts.reader);
+    worker.read_disc_paths();
+    worker.init_destination();
+    worker.copy_adpcm_audio();
+    worker.report_skipped_data();
   } catch (std::exception &ex) {
     std::cerr << ex.what() << std::endl;
     return 1;
@@ -65,25 +87,29 @@ int copy_filesystem(std::string input_path, std::string output_path,
   return 0;
 }
 
-int copy_mpeg_streams(std::string input_path, std::string output_path,
-                      const action_options & /*opts*/) {
+int copy_clut_images(std::string input_path, std::string output_path,
+                     const action_options &opts) {
   try {
-    cdi_helper worker(input_path, output_path);
+    cdi_helper worker(input_path, output_path, opts.reader);
     worker.read_disc_paths();
     worker.init_destination();
+    worker.copy_clut_images(opts.dyuv);
+    worker.report_skipped_data();
+  } catch (std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
 
-    for (const auto &path : worker.disc_paths()) {
-      worker.enum_directory(path, [&](const std::string &name,
-                                      const directory_entry &file,
-                                      const directory_entry_ex &file_ex) {
-        // Add .MEDIA suffix to stream directory name to prevent overwriting an
-        // actual file
-        const auto destination =
-            worker.init_destination(path + "/" + name + ".MEDIA", false);
-
-        worker.copy_mpeg_streams(path, file, file_ex, destination);
-      });
-    }
+int copy_rgb555_images(std::string input_path, std::string output_path,
+                       const action_options &opts) {
+  try {
+    cdi_helper worker(input_path, output_path, opts.reader);
+    worker.read_disc_paths();
+    worker.init_destination();
+    worker.copy_rgb555_images(opts.dyuv);
+    worker.report_skipped_data();
   } catch (std::exception &ex) {
     std::cerr << ex.what() << std::endl;
     return 1;
@@ -94,22 +120,24 @@ int copy_mpeg_streams(std::string input_path, std::string output_path,
 int copy_dyuv_images(std::string input_path, std::string output_path,
                      const action_options &opts) {
   try {
-    cdi_helper worker(input_path, output_path);
+    cdi_helper worker(input_path, output_path, opts.reader);
     worker.read_disc_paths();
     worker.init_destination();
 
-    for (const auto &path : worker.disc_paths()) {
-      worker.enum_directory(path, [&](const std::string &name,
-                                      const directory_entry &file,
-                                      const directory_entry_ex &file_ex) {
-        // Add .MEDIA suffix to stream directory name to prevent overwriting an
-        // actual file
-        const auto destination =
-            worker.init_destination(path + "/" + name + ".MEDIA", false);
-
-        worker.copy_dyuv_images(path, file, file_ex, opts.dyuv, destination);
-      });
+    // the calling thread keeps reading while the others encode
+    const unsigned int threads =
+        opts.threads ? opts.threads
+                     : std::max(1u, std::thread::hardware_concurrency());
+    std::unique_ptr<dyuv_encoder_pool> encoder;
+    if (threads > 1) {
+      encoder = std::make_unique<dyuv_encoder_pool>(threads - 1);
     }
+
+    worker.copy_dyuv_images(opts.dyuv, encoder.get());
+    if (encoder) {
+      encoder->wait();
+    }
+    worker.report_skipped_data();
   } catch (std::exception &ex) {
     std::cerr << ex.what() << std::endl;
     return 1;
@@ -119,8 +147,18 @@ int copy_dyuv_images(std::string input_path, std::string output_path,
 
 int copy_all(std::string input_path, std::string output_path,
              const action_options &opts) {
-  copy_filesystem(input_path, output_path, opts);
-  copy_mpeg_streams(input_path, output_path, opts);
-  copy_dyuv_images(input_path, output_path, opts);
+  try {
+    cdi_helper worker(input_path, output_path, opts.reader);
+    worker.read_disc_paths();
+    worker.init_destination();
+    const unsigned int threads =
+        opts.threads ? opts.threads
+                     : std::max(1u, std::thread::hardware_concurrency());
+    worker.copy_all(opts.dyuv, threads);
+    worker.report_skipped_data();
+  } catch (std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
   return 0;
 }
@@ -10,10 +10,15 @@
 
 #include <string>
 
+#include "cdi_lib/sector.h"
 #include "dyuv.h"
 
 struct action_options {
+  cd_i::reader_options reader;
   dyuv_options dyuv;
+  // threads for extract-files, extract-dyuv and extract-all, 0 for one per
+  // core
+  unsigned int threads = 0;
 };
 
 int print_filesystem(std::string input_path, std::string output_path,
@@ -22,6 +27,12 @@ int copy_filesystem(std::string input_path, std::string output_path,
                     const action_options &opts);
 int copy_mpeg_streams(std::string input_path, std::string output_path,
                       const action_options &opts);
+int copy_adpcm_audio(std::string input_path, std::string output_path,
+                     const action_options &opts);
+int copy_clut_images(std::string input_path, std::string output_path,
+                     const action_options &opts);
+int copy_rgb555_images(std::string input_path, std::string output_path,
+                       const action_options &opts);
 int copy_dyuv_images(std::string input_path, std::string output_path,
                      const action_options &opts);
 int copy_all(std::string input_path, std::string output_path,
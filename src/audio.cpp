@@ -0,0 +1,189 @@
+//
+//  audio.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "audio.h"
+
+#include "cdi_lib/media.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace cd_i;
+
+namespace {
+
+// Sector layout shared by all levels: 18 sound groups of 128 bytes, each with
+// 16 bytes of sound parameters followed by 112 bytes of sample data
+constexpr size_t sound_groups_per_sector = 18;
+constexpr size_t sound_group_size = 128;
+constexpr size_t sound_parameters_size = 16;
+constexpr size_t samples_per_unit = 28;
+
+constexpr std::array<int32_t, 4> filter_k0 = {{0, 60, 115, 98}};
+constexpr std::array<int32_t, 4> filter_k1 = {{0, 0, -52, -55}};
+
+// Sign-extended 4-bit samples scaled for every range
+constexpr std::array<std::array<int16_t, 16>, 13> make_nibble_table() {
+  std::array<std::array<int16_t, 16>, 13> table{};
+  for (int range = 0; range < 13; ++range) {
+    for (int nibble = 0; nibble < 16; ++nibble) {
+      const int value = nibble < 8 ? nibble : nibble - 16;
+      table[range][nibble] = static_cast<int16_t>((value * 4096) >> range);
+    }
+  }
+  return table;
+}
+
+constexpr auto nibble_table = make_nibble_table();
+
+int16_t clamp_sample(int32_t value) {
+  return static_cast<int16_t>(
+      std::min<int32_t>(std::max<int32_t>(value, -32768), 32767));
+}
+
+void put_le16(uint8_t *p, uint16_t value) {
+  p[0] = static_cast<uint8_t>(value);
+  p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+void put_le32(uint8_t *p, uint32_t value) {
+  put_le16(p, static_cast<uint16_t>(value));
+  put_le16(p + 2, static_cast<uint16_t>(value >> 16));
+}
+
+std::array<uint8_t, 44> make_wav_header(const adpcm_format &format,
+                                        uint32_t data_size) {
+  const uint16_t block_align = static_cast<uint16_t>(format.channels * 2);
+  std::array<uint8_t, 44> header{};
+  std::copy_n("RIFF", 4, header.begin());
+  put_le32(&header[4], 36 + data_size);
+  std::copy_n("WAVEfmt ", 8, header.begin() + 8);
+  put_le32(&header[16], 16);
+  // PCM
+  put_le16(&header[20], 1);
+  put_le16(&header[22], static_cast<uint16_t>(format.channels));
+  put_le32(&header[24], format.sample_rate);
+  put_le32(&header[28], format.sample_rate * block_align);
+  put_le16(&header[32], block_align);
+  put_le16(&header[34], 16);
+  std::copy_n("data", 4, header.begin() + 36);
+  put_le32(&header[40], data_size);
+  return header;
+}
+
+} // namespace
+
+adpcm_format get_adpcm_format(uint8_t coding_info) {
+  adpcm_format format;
+  format.channels = (coding_info & channel_layout_mask) == channel_layout_stereo
+                        ? 2
+                        : 1;
+  format.sample_rate =
+      (coding_info & sampling_rate_mask) == sampling_rate_18_9kHz ? 18900
+                                                                   : 37800;
+  format.bits_per_sample =
+      (coding_info & bits_per_sample_mask) == bits_per_sample_8 ? 8 : 4;
+  return format;
+}
+
+adpcm_decoder::adpcm_decoder(uint8_t coding_info)
+    : format_(get_adpcm_format(coding_info)) {}
+
+void adpcm_decoder::decode_sector(const uint8_t *data,
+                                  std::vector<int16_t> &samples) {
+  const size_t units = format_.bits_per_sample == 8 ? 4 : 8;
+  const size_t group_samples = units * samples_per_unit;
+
+  const size_t start = samples.size();
+  samples.resize(start + sound_groups_per_sector * group_samples);
+  for (size_t g = 0; g < sound_groups_per_sector; ++g) {
+    decode_sound_group(data + g * sound_group_size,
+                       &samples[start + g * group_samples]);
+  }
+}
+
+void adpcm_decoder::decode_sound_group(const uint8_t *group, int16_t *out) {
+  const bool eight_bit = format_.bits_per_sample == 8;
+  const size_t units = eight_bit ? 4 : 8;
+  const size_t channels = format_.channels;
+  const uint8_t *sample_data = group + sound_parameters_size;
+
+  for (size_t unit = 0; unit < units; ++unit) {
+    // 8-bit parameters are at 0-3, 4-bit ones at 4-11; the rest are copies
+    const uint8_t parameter = group[eight_bit ? unit : 4 + unit];
+    const unsigned int filter = (parameter >> 4) & 0x03;
+
+    // expand the unit first so that this loop has no dependencies
+    std::array<int16_t, samples_per_unit> raw;
+    if (eight_bit) {
+      const unsigned int range = std::min(parameter & 0x0fu, 8u);
+      for (size_t i = 0; i < samples_per_unit; ++i) {
+        const int8_t value = static_cast<int8_t>(sample_data[i * 4 + unit]);
+        raw[i] = static_cast<int16_t>((value * 256) >> range);
+      }
+    } else {
+      const auto &table = nibble_table[std::min(parameter & 0x0fu, 12u)];
+      const unsigned int shift = (unit & 1) * 4;
+      for (size_t i = 0; i < samples_per_unit; ++i) {
+        raw[i] = table[(sample_data[i * 4 + unit / 2] >> shift) & 0x0f];
+      }
+    }
+
+    // stereo units alternate between left and right
+    const size_t channel = channels == 2 ? unit & 1 : 0;
+    int16_t *dest = channels == 2
+                        ? out + (unit / 2) * samples_per_unit * 2 + channel
+                        : out + unit * samples_per_unit;
+
+    filter_state &state = state_[channel];
+    const int32_t k0 = filter_k0[filter];
+    const int32_t k1 = filter_k1[filter];
+    for (size_t i = 0; i < samples_per_unit; ++i) {
+      const int16_t sample = clamp_sample(
+          raw[i] + ((state.prev1 * k0 + state.prev2 * k1 + 32) >> 6));
+      state.prev2 = state.prev1;
+      state.prev1 = sample;
+      dest[i * channels] = sample;
+    }
+  }
+}
+
+wav_writer::wav_writer(const std::string &path, const adpcm_format &format)
+    : sink_(path), format_(format) {
+  // placeholder until the sizes are known
+  const auto header = make_wav_header(format_, 0);
+  sink_.write(header.data(), header.size());
+}
+
+wav_writer::~wav_writer() { close(); }
+
+void wav_writer::write(const std::vector<int16_t> &samples) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  for (const int16_t sample : samples) {
+    uint8_t bytes[2];
+    put_le16(bytes, static_cast<uint16_t>(sample));
+    sink_.write(bytes, sizeof(bytes));
+  }
+#else
+  sink_.write(samples.data(), samples.size() * sizeof(int16_t));
+#endif
+  data_size_ += samples.size() * sizeof(int16_t);
+}
+
+bool wav_writer::close() {
+  if (closed_) {
+    return !sink_.failed();
+  }
+  closed_ = true;
+
+  const uint32_t data_size = static_cast<uint32_t>(std::min<uint64_t>(
+      data_size_, std::numeric_limits<uint32_t>::max() - 36));
+  const auto header = make_wav_header(format_, data_size);
+  sink_.write_at(0, header.data(), header.size());
+  return sink_.close();
+}
@@ -0,0 +1,68 @@
+//
+//  audio.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "cdi_lib/file_sink.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+struct adpcm_format {
+  unsigned int channels = 1;
+  unsigned int sample_rate = 37800;
+  // 8 for level A, 4 for levels B and C
+  unsigned int bits_per_sample = 4;
+};
+
+adpcm_format get_adpcm_format(uint8_t coding_info);
+
+// Decodes the ADPCM sound groups of consecutive sectors of one audio channel
+// into interleaved 16-bit PCM; filter state carries over between sectors
+class adpcm_decoder {
+public:
+  explicit adpcm_decoder(uint8_t coding_info);
+
+  const adpcm_format &format() const { return format_; }
+
+  // Appends the samples of one sector's form 2 data
+  void decode_sector(const uint8_t *data, std::vector<int16_t> &samples);
+
+private:
+  struct filter_state {
+    int32_t prev1 = 0;
+    int32_t prev2 = 0;
+  };
+
+  void decode_sound_group(const uint8_t *group, int16_t *out);
+
+private:
+  adpcm_format format_;
+  std::array<filter_state, 2> state_;
+};
+
+// Streams 16-bit PCM to a WAV file; the sizes in the header are filled in by
+// close()
+class wav_writer {
+public:
+  wav_writer(const std::string &path, const adpcm_format &format);
+  ~wav_writer();
+
+  wav_writer(const wav_writer &) = delete;
+  wav_writer &operator=(const wav_writer &) = delete;
+
+  void write(const std::vector<int16_t> &samples);
+  bool close();
+
+private:
+  cd_i::file_sink sink_;
+  adpcm_format format_;
+  uint64_t data_size_ = 0;
+  bool closed_ = false;
+};
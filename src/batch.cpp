@@ -0,0 +1,240 @@
+//
+//  batch.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "batch.h"
+
+#include <boost/filesystem.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <glob.h>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sys/stat.h>
+#include <thread>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+std::vector<std::string> expand_images(const std::string &images) {
+  std::vector<std::string> paths;
+  if (images.find_first_of("*?[") != std::string::npos) {
+    glob_t matches;
+    if (glob(images.c_str(), 0, nullptr, &matches) == 0) {
+      paths.assign(matches.gl_pathv, matches.gl_pathv + matches.gl_pathc);
+    }
+    globfree(&matches);
+    return paths;
+  }
+
+  std::ifstream list(images);
+  if (!list) {
+    throw std::runtime_error("can't open image list " + images);
+  }
+  std::string line;
+  while (std::getline(list, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (!line.empty() && line[0] != '#') {
+      paths.push_back(line);
+    }
+  }
+  return paths;
+}
+
+// Output directory of every image: a directory named after the image under
+// output_path, or next to it. Images that would share one, such as
+// a/disc.bin and b/disc.bin, or game.bin and game.iso, each get a numbered
+// one instead, so that no two jobs write into the same directory.
+std::vector<fs::path> image_destinations(const std::vector<std::string> &paths,
+                                         const std::string &output_path) {
+  std::vector<fs::path> destinations;
+  std::map<std::string, size_t> uses;
+  const auto key = [](const fs::path &path) {
+    return fs::absolute(path).lexically_normal().string();
+  };
+  for (const auto &path : paths) {
+    const fs::path image(path);
+    const fs::path root =
+        output_path.empty() ? image.parent_path() : fs::path(output_path);
+    destinations.push_back(root / image.stem());
+    ++uses[key(destinations.back())];
+  }
+
+  std::set<std::string> taken;
+  for (const auto &destination : destinations) {
+    taken.insert(key(destination));
+  }
+  std::map<std::string, unsigned int> next_number;
+  for (size_t i = 0; i < destinations.size(); ++i) {
+    const auto name = key(destinations[i]);
+    if (uses[name] < 2) {
+      continue;
+    }
+    fs::path numbered;
+    do {
+      numbered = destinations[i];
+      numbered += "_" + std::to_string(++next_number[name]);
+    } while (!taken.insert(key(numbered)).second);
+    std::cerr << paths[i] << ": another image has the same name, writing to "
+              << numbered.string() << std::endl;
+    destinations[i] = numbered;
+  }
+  return destinations;
+}
+
+uint64_t image_device(const std::string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_dev : 0;
+}
+
+} // namespace
+
+batch_scheduler::batch_scheduler(unsigned int threads,
+                                 unsigned int readers_per_device)
+    : readers_per_device_(std::max(1u, readers_per_device)),
+      queues_(std::max(1u, threads)) {}
+
+void batch_scheduler::add(uint64_t device, job j) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  queues_[next_queue_].push_back(task{device, std::move(j)});
+  next_queue_ = (next_queue_ + 1) % queues_.size();
+}
+
+void batch_scheduler::run() {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    threads.emplace_back(&batch_scheduler::work, this, i);
+  }
+  work(0);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+bool batch_scheduler::take(size_t index, task &t) {
+  const auto runnable = [this](const task &candidate) {
+    const auto found = readers_.find(candidate.device);
+    return found == readers_.end() || found->second < readers_per_device_;
+  };
+
+  auto &own = queues_[index];
+  for (auto it = own.begin(); it != own.end(); ++it) {
+    if (runnable(*it)) {
+      t = std::move(*it);
+      own.erase(it);
+      return true;
+    }
+  }
+
+  for (size_t n = 1; n < queues_.size(); ++n) {
+    auto &other = queues_[(index + n) % queues_.size()];
+    for (auto it = other.rbegin(); it != other.rend(); ++it) {
+      if (runnable(*it)) {
+        t = std::move(*it);
+        other.erase(std::next(it).base());
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void batch_scheduler::work(size_t index) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    task t;
+    if (take(index, t)) {
+      ++readers_[t.device];
+      lock.unlock();
+      t.run();
+      lock.lock();
+      --readers_[t.device];
+      reader_done_.notify_all();
+      continue;
+    }
+
+    if (std::all_of(queues_.begin(), queues_.end(),
+                    [](const std::deque<task> &q) { return q.empty(); })) {
+      return;
+    }
+    // everything left is waiting for a busy device
+    reader_done_.wait(lock);
+  }
+}
+
+int run_batch(image_action action, const std::string &images,
+              const std::string &output_path, const action_options &opts,
+              const batch_options &batch) {
+  using clock = std::chrono::steady_clock;
+
+  std::vector<std::string> paths;
+  try {
+    paths = expand_images(images);
+  } catch (std::exception &ex) {
+    std::cerr << ex.what() << std::endl;
+    return 1;
+  }
+  if (paths.empty()) {
+    std::cerr << "no images match " << images << std::endl;
+    return 1;
+  }
+
+  const unsigned int threads =
+      batch.threads ? batch.threads
+                    : std::max(1u, std::thread::hardware_concurrency());
+  // the batch runs images in parallel, so each image is read by one thread
+  action_options image_opts = opts;
+  image_opts.threads = 1;
+
+  const auto destinations = image_destinations(paths, output_path);
+  std::vector<int> statuses(paths.size());
+  std::mutex report_mutex;
+  size_t finished = 0;
+
+  batch_scheduler scheduler(threads, batch.readers_per_device);
+  for (size_t i = 0; i < paths.size(); ++i) {
+    scheduler.add(image_device(paths[i]), [&, i] {
+      const auto destination = destinations[i].string();
+
+      const auto start = clock::now();
+      int status = 1;
+      try {
+        fs::create_directories(destination);
+        status = action(paths[i], destination, image_opts);
+      } catch (std::exception &ex) {
+        std::cerr << ex.what() << std::endl;
+      }
+      const double seconds =
+          std::chrono::duration<double>(clock::now() - start).count();
+
+      std::lock_guard<std::mutex> lock(report_mutex);
+      statuses[i] = status;
+      ++finished;
+      std::cout << "[" << finished << "/" << paths.size() << "] " << paths[i]
+                << (status ? ": failed" : ": done") << " in " << seconds
+                << " s" << std::endl;
+    });
+  }
+  scheduler.run();
+
+  size_t failed = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    if (statuses[i]) {
+      std::cerr << "Failed: " << paths[i] << std::endl;
+      ++failed;
+    }
+  }
+  std::cout << paths.size() << " images, " << failed << " failed"
+            << std::endl;
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,74 @@
+//
+//  batch.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "actions.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Runs jobs on a fixed set of threads. Each thread has its own queue, filled
+// round-robin, and works from the front of it; a thread whose queue has
+// nothing it can run steals from the back of the others. Every job names the
+// device it reads from, and at most readers_per_device jobs run against one
+// device at a time so that a single drive is not thrashed by many readers.
+class batch_scheduler {
+public:
+  using job = std::function<void()>;
+
+  batch_scheduler(unsigned int threads, unsigned int readers_per_device);
+
+  batch_scheduler(const batch_scheduler &) = delete;
+  batch_scheduler &operator=(const batch_scheduler &) = delete;
+
+  // Jobs must not throw
+  void add(uint64_t device, job j);
+  // Runs all added jobs and returns when they are done
+  void run();
+
+private:
+  struct task {
+    uint64_t device;
+    job run;
+  };
+
+  void work(size_t index);
+  bool take(size_t index, task &t);
+
+private:
+  unsigned int readers_per_device_;
+  std::vector<std::deque<task>> queues_;
+  size_t next_queue_ = 0;
+  std::mutex mutex_;
+  std::condition_variable reader_done_;
+  std::unordered_map<uint64_t, unsigned int> readers_;
+};
+
+using image_action = std::function<int(std::string, std::string,
+                                       const action_options &)>;
+
+struct batch_options {
+  // images extracted at the same time, 0 for one per core
+  unsigned int threads = 0;
+  unsigned int readers_per_device = 2;
+};
+
+// Runs action on every image listed in images, which is either a glob
+// pattern or a file with one image path per line. Each image gets its own
+// output directory named after it under output_path, or next to the image if
+// output_path is empty; images whose names clash get numbered directories.
+// Returns non-zero if any image failed.
+int run_batch(image_action action, const std::string &images,
+              const std::string &output_path, const action_options &opts,
+              const batch_options &batch);
@@ -0,0 +1,136 @@
+//
+//  bench.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+#include <thread>
+
+namespace bench {
+
+void run_sector_benchmarks();
+void run_parse_benchmarks();
+void run_dyuv_benchmarks();
+void run_png_benchmarks();
+void run_audio_benchmarks();
+void run_rgb555_benchmarks();
+
+namespace {
+
+struct bench_options {
+  bool json = false;
+  std::string filter;
+  double min_seconds = 0.5;
+};
+
+bench_options options;
+std::vector<result> results;
+
+std::string json_string(const std::string &s) {
+  std::string escaped = "\"";
+  for (const char c : s) {
+    if (c == '"' || c == '\\') {
+      escaped += '\\';
+    }
+    escaped += c;
+  }
+  return escaped + "\"";
+}
+
+void print_json() {
+  printf("{\n");
+  printf("  \"context\": {\n");
+  printf("    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+  printf("    \"min_time\": %g\n", options.min_seconds);
+  printf("  },\n");
+  printf("  \"benchmarks\": [");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &r = results[i];
+    printf("%s\n    {\n", i ? "," : "");
+    printf("      \"name\": %s,\n", json_string(r.name).c_str());
+    printf("      \"iterations\": %llu,\n",
+           static_cast<unsigned long long>(r.iterations));
+    printf("      \"real_time_ns\": %.1f,\n", r.seconds * 1e9 / r.iterations);
+    printf("      \"bytes_per_second\": %.0f,\n", r.bytes_per_second());
+    printf("      \"items_per_second\": %.0f\n", r.items_per_second());
+    printf("    }");
+  }
+  printf("\n  ]\n}\n");
+}
+
+bool parse_arguments(int argc, const char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--json") {
+      options.json = true;
+    } else if (arg.compare(0, 9, "--filter=") == 0) {
+      options.filter = arg.substr(9);
+    } else if (arg.compare(0, 11, "--min-time=") == 0) {
+      options.min_seconds = std::strtod(arg.c_str() + 11, nullptr);
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--json] [--filter=<substring>] "
+              "[--min-time=<seconds>]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+double result::bytes_per_second() const {
+  return seconds > 0 ? iterations * bytes_per_iteration / seconds : 0;
+}
+
+double result::items_per_second() const {
+  return seconds > 0 ? iterations * items_per_iteration / seconds : 0;
+}
+
+bool selected(const std::string &name) {
+  return name.find(options.filter) != std::string::npos;
+}
+
+double min_seconds() { return options.min_seconds; }
+
+void report(const result &r) {
+  results.push_back(r);
+  // with --json the table goes to stderr so that stdout stays parseable
+  fprintf(options.json ? stderr : stdout,
+          "%-40s %12.0f items/s %10.1f MB/s\n", r.name.c_str(),
+          r.items_per_second(), r.bytes_per_second() / (1024 * 1024));
+}
+
+std::string make_temp_path() {
+  namespace fs = boost::filesystem;
+  return (fs::temp_directory_path() / fs::unique_path("cdix_bench-%%%%%%%%"))
+      .string();
+}
+
+} // namespace bench
+
+int main(int argc, const char *argv[]) {
+  if (!bench::parse_arguments(argc, argv)) {
+    return 1;
+  }
+
+  bench::run_sector_benchmarks();
+  bench::run_parse_benchmarks();
+  bench::run_dyuv_benchmarks();
+  bench::run_png_benchmarks();
+  bench::run_audio_benchmarks();
+  bench::run_rgb555_benchmarks();
+
+  if (bench::options.json) {
+    bench::print_json();
+  }
+  return 0;
+}
@@ -0,0 +1,71 @@
+//
+//  bench.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+struct result {
+  std::string name;
+  uint64_t iterations = 0;
+  double seconds = 0;
+  uint64_t bytes_per_iteration = 0;
+  uint64_t items_per_iteration = 0;
+
+  double bytes_per_second() const;
+  double items_per_second() const;
+};
+
+// Keeps the optimizer from discarding work whose result is otherwise unused
+inline void do_not_optimize(const void *p) {
+  asm volatile("" : : "g"(p) : "memory");
+}
+
+// False if the benchmark was left out with --filter
+bool selected(const std::string &name);
+// Minimum time each benchmark runs for, set with --min-time
+double min_seconds();
+void report(const result &r);
+
+// Path of a file in the temporary directory that does not exist yet
+std::string make_temp_path();
+
+template <typename F>
+result run(std::string name, uint64_t bytes_per_iteration,
+           uint64_t items_per_iteration, F body) {
+  using clock = std::chrono::steady_clock;
+
+  result r;
+  if (!selected(name)) {
+    return r;
+  }
+  r.name = std::move(name);
+  r.bytes_per_iteration = bytes_per_iteration;
+  r.items_per_iteration = items_per_iteration;
+
+  uint64_t batch = 1;
+  while (r.seconds < min_seconds()) {
+    const auto start = clock::now();
+    for (uint64_t i = 0; i < batch; ++i) {
+      body();
+    }
+    r.seconds += std::chrono::duration<double>(clock::now() - start).count();
+    r.iterations += batch;
+    batch *= 2;
+  }
+
+  report(r);
+  return r;
+}
+
+} // namespace bench
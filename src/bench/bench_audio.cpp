@@ -0,0 +1,54 @@
+//
+//  bench_audio.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+
+#include "audio.h"
+#include "cdi_lib/media.h"
+#include "cdi_lib/sector.h"
+
+#include <array>
+#include <random>
+
+using namespace cd_i;
+
+namespace bench {
+
+void run_audio_benchmarks() {
+  std::mt19937 rng(2324);
+  std::array<uint8_t, mode2_form2_data_size> data;
+  for (auto &byte : data) {
+    byte = static_cast<uint8_t>(rng());
+  }
+
+  struct level {
+    const char *name;
+    uint8_t coding_info;
+  };
+  const std::array<level, 3> levels = {{
+      {"decode_adpcm/level_a_stereo",
+       channel_layout_stereo | sampling_rate_37_8kHz | bits_per_sample_8},
+      {"decode_adpcm/level_b_stereo",
+       channel_layout_stereo | sampling_rate_37_8kHz | bits_per_sample_4},
+      {"decode_adpcm/level_c_mono",
+       channel_layout_mono | sampling_rate_18_9kHz | bits_per_sample_4},
+  }};
+
+  // items are sectors; a single-speed disc reads 75 of them per second
+  std::vector<int16_t> samples;
+  for (const auto &l : levels) {
+    adpcm_decoder decoder(l.coding_info);
+    run(l.name, data.size(), 1, [&] {
+      samples.clear();
+      decoder.decode_sector(data.data(), samples);
+      do_not_optimize(samples.data());
+    });
+  }
+}
+
+} // namespace bench
@@ -0,0 +1,71 @@
+//
+//  bench_dyuv.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+
+#include "dyuv.h"
+
+#include <boost/format.hpp>
+
+#include <cstdio>
+#include <random>
+
+namespace bench {
+
+namespace {
+
+std::vector<uint8_t> make_random_frame(const dyuv_size &size) {
+  std::mt19937 rng(static_cast<unsigned>(size.width * size.height));
+  std::vector<uint8_t> frame(size.width * size.height);
+  for (auto &byte : frame) {
+    byte = static_cast<uint8_t>(rng());
+  }
+  return frame;
+}
+
+} // namespace
+
+void run_dyuv_benchmarks() {
+  for (const auto &size : supported_dyuv_sizes) {
+    const auto frame = make_random_frame(size);
+
+    for (const bool interpolate : {true, false}) {
+      dyuv_options options;
+      options.size = size;
+      options.interpolate = interpolate;
+      options.seed = {static_cast<uint8_t>(size.height), 7, 250};
+
+      std::vector<uint8_t> expected;
+      std::vector<uint8_t> actual;
+      decode_dyuv_scalar(frame, options, expected);
+      decode_dyuv(frame, options, actual);
+      if (actual != expected) {
+        fprintf(stderr, "decode_dyuv %lux%lu: output mismatch\n", size.width,
+                size.height);
+      }
+    }
+
+    dyuv_options options;
+    options.size = size;
+    const auto suffix =
+        (boost::format("/%lux%lu") % size.width % size.height).str();
+    std::vector<uint8_t> rgb_data;
+
+    run("decode_dyuv_scalar" + suffix, frame.size(), 1, [&] {
+      decode_dyuv_scalar(frame, options, rgb_data);
+      do_not_optimize(rgb_data.data());
+    });
+
+    run("decode_dyuv" + suffix, frame.size(), 1, [&] {
+      decode_dyuv(frame, options, rgb_data);
+      do_not_optimize(rgb_data.data());
+    });
+  }
+}
+
+} // namespace bench
@@ -0,0 +1,246 @@
+//
+//  bench_parse.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+#include "image_generator.h"
+
+#include "cdi_lib/index.h"
+#include "cdi_lib/media.h"
+#include "cdi_lib/parse.h"
+#include "cdi_lib/structure.h"
+#include "cdi_lib/util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/format.hpp>
+
+#include <random>
+
+using namespace cd_i;
+
+namespace bench {
+
+namespace {
+
+// Sector mix of a typical disc: filesystem data, real-time MPEG, ADPCM audio
+// and images with the odd message and empty sector in between
+std::vector<sector_data> make_sector_mix(uint32_t count) {
+  struct kind {
+    uint8_t submode;
+    uint8_t coding_info;
+  };
+  const std::array<kind, 8> kinds = {{
+      {submode::data, 0},
+      {submode::data | submode::eor | submode::eof, 0},
+      {submode::video | submode::form | submode::realtime, video_coding_MPEG},
+      {submode::audio | submode::form | submode::realtime, audio_coding_MPEG},
+      {submode::audio | submode::form | submode::realtime,
+       channel_layout_stereo | bits_per_sample_4},
+      {submode::video | submode::realtime, coding_DYUV},
+      {submode::form, 0},
+      {0, 0},
+  }};
+
+  std::mt19937 rng(count);
+  std::vector<sector_data> sectors;
+  sectors.reserve(count);
+  for (uint32_t block = 0; block < count; ++block) {
+    const auto &k = kinds[rng() % kinds.size()];
+    const uint8_t channel = k.submode ? rng() % 4 : 0;
+    sectors.push_back(
+        make_sector(block, 1, channel, k.submode, k.coding_info, block));
+  }
+  return sectors;
+}
+
+// Bytes are counted as the headers looked at, not whole sectors
+template <typename P>
+void run_predicate(const std::string &name,
+                   const std::vector<sector_data> &sectors, P predicate) {
+  const size_t header_bytes = sectors.size() * sizeof(sector_header);
+  run("parse::" + name, header_bytes, sectors.size(), [&] {
+    size_t matches = 0;
+    for (const auto &sector : sectors) {
+      matches += predicate(sector);
+    }
+    do_not_optimize(&matches);
+  });
+}
+
+std::vector<mode2_form1_data> make_directory_extent(unsigned files) {
+  std::vector<mode2_form1_data> extent;
+  size_t offset = 0;
+  append_directory_record(extent, offset, std::string(1, '\0'), 20, 2048,
+                          file_attr::directory, 0);
+  append_directory_record(extent, offset, std::string(1, '\1'), 18, 2048,
+                          file_attr::directory, 0);
+  for (unsigned i = 0; i < files; ++i) {
+    const auto name = (boost::format("FILE%04u.RTF;1") % i).str();
+    append_directory_record(extent, offset, name, 100 + i * 64, 64 * 2048, 0,
+                            1);
+  }
+  return extent;
+}
+
+// The file with the most sectors, which is one of the real-time files
+directory_entry_2 largest_file(disc_structure_reader &reader) {
+  directory_entry_2 largest{};
+  for (const auto &path : reader.copy_all_paths()) {
+    reader.read_directory(path, [&](std::string, const directory_entry &entry,
+                                    const directory_entry_ex &entry_ex) {
+      if (!parse::is_directory(entry_ex) &&
+          util::swap_byte_order(entry.file_size) >
+              util::swap_byte_order(largest.first.file_size)) {
+        largest = std::make_pair(entry, entry_ex);
+      }
+      return true;
+    });
+  }
+  return largest;
+}
+
+// Iterates over the sectors of one of a file's channels
+void run_channel_range_benchmark(const std::string &name,
+                                 disc_structure_reader &reader,
+                                 const directory_entry_2 &file,
+                                 size_t num_sectors) {
+  const size_t file_size = util::swap_byte_order(file.first.file_size);
+  run(name, file_size, num_sectors, [&] {
+    size_t bytes = 0;
+    const auto wanted = [](const sector_header &header) {
+      return header.channel_num == 0;
+    };
+    for (const auto &s : reader.sectors(file.first, file.second, wanted)) {
+      bytes += s.size;
+    }
+    do_not_optimize(&bytes);
+  });
+}
+
+// Walks the sectors of a file through the callback and the range interface,
+// so that the difference is the cost of calling the handler per sector, and
+// then only one of its channels. With an index the other channels are
+// skipped from their indexed headers without being read, which leaves little
+// besides the cost of calling the predicate.
+void run_file_sector_benchmarks() {
+  const auto path = make_temp_path();
+  image_options options;
+  options.realtime_files = 1;
+  options.realtime_channels = 4;
+  if (!write_synthetic_image(options, path)) {
+    return;
+  }
+
+  {
+    disc_structure_reader reader(path);
+    reader.init_reader();
+    const auto file = largest_file(reader);
+    const size_t file_size = util::swap_byte_order(file.first.file_size);
+    size_t num_sectors = 0;
+    for (const auto &s : reader.sectors(file.first, file.second)) {
+      num_sectors += s.size != 0;
+    }
+
+    run("structure::scan_file", file_size, num_sectors, [&] {
+      size_t bytes = 0;
+      reader.scan_file(file.first, file.second,
+                       [&](const sector_data &sector) {
+                         bytes += parse::is_mode2_form2_sector(sector)
+                                      ? mode2_form2_data_size
+                                      : mode2_form1_data_size;
+                         return true;
+                       });
+      do_not_optimize(&bytes);
+    });
+    run("structure::sectors", file_size, num_sectors, [&] {
+      size_t bytes = 0;
+      for (const auto &s : reader.sectors(file.first, file.second)) {
+        bytes += parse::is_mode2_form2_sector(*s.sector)
+                     ? mode2_form2_data_size
+                     : mode2_form1_data_size;
+      }
+      do_not_optimize(&bytes);
+    });
+    // the other channels are skipped after unscrambling just their headers
+    run_channel_range_benchmark("structure::sectors/one_channel", reader, file,
+                                num_sectors);
+
+    reader_options indexed;
+    indexed.use_index = true;
+    disc_structure_reader indexed_reader(path, indexed);
+    indexed_reader.init_reader();
+    run_channel_range_benchmark("structure::sectors/indexed/one_channel",
+                                indexed_reader, file, num_sectors);
+  }
+  boost::filesystem::remove(path);
+  boost::filesystem::remove(sector_index::sidecar_path(path));
+}
+
+} // namespace
+
+void run_parse_benchmarks() {
+  const auto sectors = make_sector_mix(1024);
+
+  run_predicate("is_valid_sector", sectors, [](const sector_data &s) {
+    return parse::is_valid_sector(s);
+  });
+  run_predicate("is_mode2_form1_sector", sectors, [](const sector_data &s) {
+    return parse::is_mode2_form1_sector(s);
+  });
+  run_predicate("is_mode2_form2_sector", sectors, [](const sector_data &s) {
+    return parse::is_mode2_form2_sector(s);
+  });
+  run_predicate("is_eof_sector", sectors, [](const sector_data &s) {
+    return parse::is_eof_sector(s);
+  });
+  run_predicate("is_message_sector", sectors, [](const sector_data &s) {
+    return parse::is_message_sector(s);
+  });
+  run_predicate("is_empty_sector", sectors, [](const sector_data &s) {
+    return parse::is_empty_sector(s);
+  });
+  run_predicate("is_mpeg_audio_sector", sectors, [](const sector_data &s) {
+    return parse::is_mpeg_audio_sector(s);
+  });
+  run_predicate("is_adpcm_audio_sector", sectors, [](const sector_data &s) {
+    return parse::is_adpcm_audio_sector(s);
+  });
+  run_predicate("is_mpeg_video_sector", sectors, [](const sector_data &s) {
+    return parse::is_mpeg_video_sector(s);
+  });
+
+  std::vector<sector_header> headers;
+  headers.reserve(sectors.size());
+  for (const auto &sector : sectors) {
+    headers.push_back(parse::get_sector_header(sector));
+  }
+  std::vector<uint8_t> matches(headers.size());
+  run("sector_filter::match", headers.size() * sizeof(sector_header),
+      headers.size(), [&] {
+        filters::mpeg_video.match(headers.data(), headers.size(),
+                                  matches.data());
+        do_not_optimize(matches.data());
+      });
+
+  constexpr unsigned files = 256;
+  const auto extent = make_directory_extent(files);
+  const size_t extent_size = extent.size() * mode2_form1_data_size;
+  run("parse_directory", extent_size, files + 2, [&] {
+    size_t records = 0;
+    disc_structure_reader::parse_directory(
+        extent, [&](const std::string &name, const directory_entry &,
+                    const directory_entry_ex &) {
+          records += name.size();
+          return true;
+        });
+    do_not_optimize(&records);
+  });
+
+  run_file_sector_benchmarks();
+}
+
+} // namespace bench
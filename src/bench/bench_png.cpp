@@ -0,0 +1,60 @@
+//
+//  bench_png.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+
+#include "dyuv.h"
+#include "png_file.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+
+namespace bench {
+
+void run_png_benchmarks() {
+  const dyuv_size size;
+  const size_t pixels = size.width * size.height;
+  const auto path = make_temp_path();
+
+  // smooth gradients compress about as well as decoded disc images do
+  std::vector<uint8_t> rgb_data(pixels * 3);
+  std::vector<uint8_t> indices(pixels);
+  for (size_t y = 0; y < size.height; ++y) {
+    for (size_t x = 0; x < size.width; ++x) {
+      const size_t i = y * size.width + x;
+      rgb_data[i * 3] = static_cast<uint8_t>(x);
+      rgb_data[i * 3 + 1] = static_cast<uint8_t>(y);
+      rgb_data[i * 3 + 2] = static_cast<uint8_t>((x + y) / 2);
+      indices[i] = static_cast<uint8_t>((x / 8) ^ (y / 8));
+    }
+  }
+
+  png_palette palette(256);
+  for (size_t i = 0; i < palette.size(); ++i) {
+    palette[i] = {static_cast<uint8_t>(i), static_cast<uint8_t>(i),
+                  static_cast<uint8_t>(i)};
+  }
+
+  run("write_png_file", rgb_data.size(), 1, [&] {
+    if (!write_png_file(rgb_data, size.width, size.height, path)) {
+      fprintf(stderr, "write_png_file: failed\n");
+    }
+  });
+
+  run("write_indexed_png_file", indices.size(), 1, [&] {
+    if (!write_indexed_png_file(indices, size.width, size.height, palette, 8,
+                                path)) {
+      fprintf(stderr, "write_indexed_png_file: failed\n");
+    }
+  });
+
+  boost::filesystem::remove(path);
+}
+
+} // namespace bench
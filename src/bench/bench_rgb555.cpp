@@ -0,0 +1,50 @@
+//
+//  bench_rgb555.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+
+#include "dyuv.h"
+#include "rgb555.h"
+
+#include <cstdio>
+#include <random>
+
+namespace bench {
+
+void run_rgb555_benchmarks() {
+  const dyuv_size size;
+  const size_t pixels = size.width * size.height;
+
+  std::mt19937 rng(555);
+  std::vector<uint8_t> lower(pixels);
+  std::vector<uint8_t> upper(pixels);
+  for (size_t i = 0; i < pixels; ++i) {
+    lower[i] = static_cast<uint8_t>(rng());
+    upper[i] = static_cast<uint8_t>(rng());
+  }
+
+  std::vector<uint8_t> expected(pixels * 3);
+  std::vector<uint8_t> actual(pixels * 3);
+  merge_rgb555_scalar(lower.data(), upper.data(), pixels, expected.data());
+  merge_rgb555(lower.data(), upper.data(), pixels, actual.data());
+  if (actual != expected) {
+    fprintf(stderr, "merge_rgb555: output mismatch\n");
+  }
+
+  run("merge_rgb555_scalar", pixels * 2, 1, [&] {
+    merge_rgb555_scalar(lower.data(), upper.data(), pixels, actual.data());
+    do_not_optimize(actual.data());
+  });
+
+  run("merge_rgb555", pixels * 2, 1, [&] {
+    merge_rgb555(lower.data(), upper.data(), pixels, actual.data());
+    do_not_optimize(actual.data());
+  });
+}
+
+} // namespace bench
@@ -0,0 +1,149 @@
+//
+//  bench_sector.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "bench.h"
+#include "image_generator.h"
+
+#include "cdi_lib/sector.h"
+#include "cdi_lib/util.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdio>
+#include <fstream>
+#include <random>
+
+using namespace cd_i;
+
+namespace bench {
+
+namespace {
+
+// Bit-serial descrambler that unscramble_sector used before the table
+void unscramble_sector_lfsr(sector_data &sector) {
+  uint16_t lfsr = 1;
+  for (auto it = sector.begin() + sync_pattern.size(); it != sector.end();
+       ++it) {
+    uint16_t byte = *it;
+    for (unsigned i = 0; i < 8; ++i) {
+      byte ^= util::shift_lfsr(&lfsr) << i;
+    }
+    *it = static_cast<uint8_t>(byte);
+  }
+}
+
+sector_data make_random_sector() {
+  std::mt19937 rng(2352);
+  sector_data sector;
+  std::copy(sync_pattern.begin(), sync_pattern.end(), sector.begin());
+  for (auto it = sector.begin() + sync_pattern.size(); it != sector.end();
+       ++it) {
+    *it = static_cast<uint8_t>(rng());
+  }
+  return sector;
+}
+
+// Writes a scrambled image of count data sectors and returns its path
+std::string make_image(uint32_t count) {
+  const disc_sequential_reader scrambler("");
+  const auto path = make_temp_path();
+  std::ofstream out(path, std::ios_base::binary);
+  for (uint32_t block = 0; block < count; ++block) {
+    // scrambling is the same XOR as unscrambling
+    sector_data sector = make_sector(block, 1, 0, submode::data, 0, block);
+    scrambler.unscramble_sector(sector);
+    out.write(reinterpret_cast<const char *>(sector.data()), sector.size());
+  }
+  return path;
+}
+
+void run_fetch_benchmarks() {
+  constexpr uint32_t count = 4096;
+  const auto path = make_image(count);
+
+  for (const bool use_mmap : {true, false}) {
+    reader_options options;
+    options.use_mmap = use_mmap;
+    const std::string backend = use_mmap ? "/mmap" : "/stream";
+
+    disc_sequential_reader reader(path, options);
+    sector_data sector;
+    run("fetch_next_sector/copy" + backend, count * sector_size, count, [&] {
+      reader.seek(0);
+      for (uint32_t i = 0; i < count; ++i) {
+        reader.fetch_next_sector(sector);
+      }
+      do_not_optimize(sector.data());
+    });
+
+    run("fetch_next_sector/view" + backend, count * sector_size, count, [&] {
+      reader.seek(0);
+      const sector_data *view = nullptr;
+      for (uint32_t i = 0; i < count; ++i) {
+        reader.fetch_next_sector(view);
+      }
+      do_not_optimize(view);
+    });
+
+    // fetch and descramble, the work every extract command starts with
+    run("fetch_next_sector/unscramble" + backend, count * sector_size, count,
+        [&] {
+          reader.seek(0);
+          for (uint32_t i = 0; i < count; ++i) {
+            reader.fetch_next_sector(sector);
+            reader.unscramble_sector(sector);
+          }
+          do_not_optimize(sector.data());
+        });
+
+    for (const size_t batch_size : {64, 256, 1024}) {
+      sector_batch batch(batch_size);
+      run("fetch_sectors/" + std::to_string(batch_size) + backend,
+          count * sector_size, count, [&] {
+            reader.seek(0);
+            size_t fetched = 0;
+            while (fetched < count && reader.fetch_sectors(batch)) {
+              fetched += batch.size();
+            }
+            do_not_optimize(batch.headers());
+          });
+    }
+  }
+
+  boost::filesystem::remove(path);
+}
+
+} // namespace
+
+void run_sector_benchmarks() {
+  const sector_data original = make_random_sector();
+
+  sector_data expected = original;
+  unscramble_sector_lfsr(expected);
+  sector_data actual = original;
+  disc_sequential_reader("").unscramble_sector(actual);
+  if (actual != expected) {
+    fprintf(stderr, "unscramble_sector: output mismatch\n");
+  }
+
+  sector_data sector = original;
+  run("unscramble_sector/lfsr", sector_size, 1, [&] {
+    unscramble_sector_lfsr(sector);
+    do_not_optimize(sector.data());
+  });
+
+  const disc_sequential_reader reader("");
+  run("unscramble_sector/table", sector_size, 1, [&] {
+    reader.unscramble_sector(sector);
+    do_not_optimize(sector.data());
+  });
+
+  run_fetch_benchmarks();
+}
+
+} // namespace bench
@@ -0,0 +1,86 @@
+//
+//  gen.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "image_generator.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Parses --<key>=<value> into value; false if arg is some other option
+template <typename T>
+bool parse_value(const std::string &arg, const std::string &key, T &value) {
+  const std::string prefix = "--" + key + "=";
+  if (arg.compare(0, prefix.size(), prefix) != 0) {
+    return false;
+  }
+  value =
+      static_cast<T>(std::strtoull(arg.c_str() + prefix.size(), nullptr, 0));
+  return true;
+}
+
+void print_usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s [options] <output_path>\n"
+          "\n"
+          "Writes a synthetic scrambled CD-i track image.\n"
+          "\n"
+          "Options:\n"
+          "  --sectors=<n>         approximate image size (default: 20000)\n"
+          "  --seed=<n>            random seed (default: 1)\n"
+          "  --depth=<n>           directory levels below the root "
+          "(default: 4)\n"
+          "  --fanout=<n>          subdirectories per directory (default: 2)\n"
+          "  --files=<n>           plain files per directory (default: 3)\n"
+          "  --max-file-size=<n>   largest plain file in bytes "
+          "(default: 65536)\n"
+          "  --realtime-files=<n>  interleaved real-time files (default: 4)\n"
+          "  --channels=<n>        channels per media type in each real-time "
+          "file (default: 4)\n"
+          "  --damage=<n>          file sectors to corrupt (default: 0)\n",
+          name);
+}
+
+} // namespace
+
+int main(int argc, const char *argv[]) {
+  bench::image_options options;
+  std::string output_path;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (parse_value(arg, "sectors", options.sectors) ||
+        parse_value(arg, "seed", options.seed) ||
+        parse_value(arg, "depth", options.directory_depth) ||
+        parse_value(arg, "fanout", options.directory_fanout) ||
+        parse_value(arg, "files", options.files_per_directory) ||
+        parse_value(arg, "max-file-size", options.max_file_size) ||
+        parse_value(arg, "realtime-files", options.realtime_files) ||
+        parse_value(arg, "channels", options.realtime_channels) ||
+        parse_value(arg, "damage", options.damaged_sectors)) {
+      continue;
+    }
+    if (arg.compare(0, 1, "-") == 0 || !output_path.empty()) {
+      print_usage(argv[0]);
+      return 1;
+    }
+    output_path = arg;
+  }
+  if (output_path.empty() || options.max_file_size == 0) {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  const auto sectors = bench::write_synthetic_image(options, output_path);
+  if (!sectors) {
+    fprintf(stderr, "error writing %s\n", output_path.c_str());
+    return 1;
+  }
+  fprintf(stderr, "Wrote %u sectors to %s\n", sectors, output_path.c_str());
+  return 0;
+}
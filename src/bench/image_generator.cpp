@@ -0,0 +1,432 @@
+//
+//  image_generator.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "image_generator.h"
+
+#include "cdi_lib/file_sink.h"
+#include "cdi_lib/media.h"
+#include "cdi_lib/structure.h"
+#include "cdi_lib/util.h"
+#include "dyuv.h"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <set>
+
+using namespace cd_i;
+
+namespace bench {
+
+namespace {
+
+constexpr uint32_t label_block = 16;
+constexpr uint32_t path_table_block = label_block + 2;
+
+constexpr uint16_t file_attributes =
+    file_attr::owner_read | file_attr::group_read | file_attr::world_read;
+constexpr uint16_t directory_attributes =
+    file_attributes | file_attr::directory | file_attr::owner_execute |
+    file_attr::group_execute | file_attr::world_execute;
+
+struct realtime_sector {
+  uint8_t channel_num;
+  uint8_t submode;
+  uint8_t coding_info;
+};
+
+struct file_node {
+  std::string name;
+  uint32_t address = 0;
+  uint32_t size = 0;
+  uint32_t sectors = 0;
+  // empty for plain files
+  std::vector<realtime_sector> realtime;
+};
+
+struct directory_node {
+  std::string name;
+  uint32_t parent = 0;
+  std::vector<uint32_t> children;
+  std::vector<uint32_t> files;
+  uint32_t address = 0;
+  std::vector<mode2_form1_data> extent;
+};
+
+uint8_t to_bcd(uint32_t n) {
+  return static_cast<uint8_t>((n / 10) << 4 | n % 10);
+}
+
+uint32_t blocks_for(size_t size) {
+  return static_cast<uint32_t>(
+      std::max<size_t>(1, (size + mode2_form1_data_size - 1) /
+                              mode2_form1_data_size));
+}
+
+// Real-time file of count sectors: MPEG video and audio, ADPCM audio and DYUV
+// images spread over channels in random order, with DYUV frames ending in EOR
+std::vector<realtime_sector> plan_realtime_file(std::mt19937 &rng,
+                                                uint32_t count,
+                                                unsigned channels) {
+  const std::array<uint8_t, 4> adpcm_codings = {{
+      channel_layout_stereo | sampling_rate_37_8kHz | bits_per_sample_4,
+      channel_layout_mono | sampling_rate_18_9kHz | bits_per_sample_4,
+      channel_layout_stereo | sampling_rate_37_8kHz | bits_per_sample_8,
+      channel_layout_mono | sampling_rate_37_8kHz | bits_per_sample_8,
+  }};
+  const dyuv_size frame_size;
+  const size_t frame_bytes = frame_size.width * frame_size.height;
+
+  std::vector<size_t> dyuv_offsets(channels);
+  std::vector<realtime_sector> sectors(count);
+  for (auto &s : sectors) {
+    s.channel_num = static_cast<uint8_t>(rng() % channels);
+    // weighted towards video the way FMV titles are
+    const unsigned kind = rng() % 13;
+    if (kind < 6) {
+      s.submode = submode::video | submode::form | submode::realtime;
+      s.coding_info = video_coding_MPEG;
+    } else if (kind < 8) {
+      s.submode = submode::audio | submode::form | submode::realtime;
+      s.coding_info = audio_coding_MPEG;
+    } else if (kind < 10) {
+      s.submode = submode::audio | submode::form | submode::realtime;
+      s.coding_info = adpcm_codings[s.channel_num % adpcm_codings.size()];
+    } else {
+      s.submode = submode::video | submode::realtime;
+      s.coding_info = coding_DYUV;
+      auto &offset = dyuv_offsets[s.channel_num];
+      offset += mode2_form1_data_size;
+      if (offset >= frame_bytes) {
+        s.submode |= submode::eor;
+        offset = 0;
+      }
+    }
+  }
+  sectors.back().submode |= submode::eof;
+  return sectors;
+}
+
+std::vector<uint8_t> make_path_table(const std::vector<directory_node> &dirs) {
+  std::vector<uint8_t> table;
+  for (const auto &dir : dirs) {
+    path_table_entry entry;
+    entry.name_len = static_cast<uint8_t>(dir.name.size());
+    entry.ext_attr_len = 0;
+    entry.directory_address = util::swap_byte_order(dir.address);
+    // path table numbers are 1-based, big-endian
+    const uint16_t parent = static_cast<uint16_t>(dir.parent + 1);
+    entry.parent_directory_number =
+        static_cast<uint16_t>(parent << 8 | parent >> 8);
+
+    const auto *bytes = reinterpret_cast<const uint8_t *>(&entry);
+    table.insert(table.end(), bytes, bytes + sizeof(entry));
+    table.insert(table.end(), dir.name.begin(), dir.name.end());
+    if (dir.name.size() & 1) {
+      table.push_back(0);
+    }
+  }
+  return table;
+}
+
+void fill_directory_extent(std::vector<directory_node> &dirs, size_t index,
+                           const std::vector<file_node> &files) {
+  auto &dir = dirs[index];
+  const auto extent_size = [](const directory_node &d) {
+    return static_cast<uint32_t>(
+        std::max<size_t>(1, d.extent.size()) * mode2_form1_data_size);
+  };
+
+  std::vector<mode2_form1_data> extent;
+  size_t offset = 0;
+  append_directory_record(extent, offset, std::string(1, '\0'), dir.address,
+                          extent_size(dir), directory_attributes, 0);
+  const auto &parent = dirs[dir.parent];
+  append_directory_record(extent, offset, std::string(1, '\1'),
+                          parent.address, extent_size(parent),
+                          directory_attributes, 0);
+  for (const auto child : dir.children) {
+    append_directory_record(extent, offset, dirs[child].name,
+                            dirs[child].address, extent_size(dirs[child]),
+                            directory_attributes, 0);
+  }
+  for (const auto f : dir.files) {
+    const auto &file = files[f];
+    append_directory_record(extent, offset, file.name + ";1", file.address,
+                            file.size, file_attributes,
+                            file.realtime.empty() ? 0 : 1);
+  }
+  dir.extent = std::move(extent);
+}
+
+class image_writer {
+public:
+  image_writer(const std::string &path, uint64_t expected_size,
+               std::set<uint32_t> damaged, unsigned seed)
+      : out_(path, expected_size), damaged_(std::move(damaged)), seed_(seed) {}
+
+  void add(uint8_t file_num, uint8_t channel_num, uint8_t submode,
+           uint8_t coding_info, const void *data = nullptr) {
+    const uint32_t block = block_++;
+    if (damaged_.count(block)) {
+      add_noise(block);
+      return;
+    }
+    sector_data sector = make_sector(block, file_num, channel_num, submode,
+                                     coding_info, seed_ + block);
+    if (data) {
+      memcpy(&sector[mode2_form1_data_offset], data, mode2_form1_data_size);
+    }
+    // scrambling is the same XOR as unscrambling
+    scrambler_.unscramble_sector(sector);
+    out_.write(sector.data(), sector.size());
+  }
+
+  uint32_t block() const { return block_; }
+  bool close() { return out_.close(); }
+
+private:
+  void add_noise(uint32_t block) {
+    std::mt19937 rng(seed_ ^ block);
+    std::vector<uint8_t> noise(sector_size + 1 + rng() % 63);
+    for (auto &byte : noise) {
+      byte = static_cast<uint8_t>(rng());
+    }
+    // no sync pattern where the sector used to be
+    noise[0] = 0xff;
+    out_.write(noise.data(), noise.size());
+  }
+
+private:
+  file_sink out_;
+  std::set<uint32_t> damaged_;
+  unsigned seed_;
+  uint32_t block_ = 0;
+  const disc_sequential_reader scrambler_{""};
+};
+
+} // namespace
+
+sector_data make_sector(uint32_t block, uint8_t file_num, uint8_t channel_num,
+                        uint8_t submode, uint8_t coding_info, unsigned seed) {
+  std::mt19937_64 rng(seed);
+  sector_data sector;
+  for (size_t i = 0; i < sector.size(); i += sizeof(uint64_t)) {
+    const uint64_t noise = rng();
+    memcpy(&sector[i], &noise, std::min(sizeof(noise), sector.size() - i));
+  }
+  std::copy(sync_pattern.begin(), sync_pattern.end(), sector.begin());
+
+  // addresses start two seconds into the track
+  const uint32_t address = block + 150;
+  sector_header header;
+  header.minutes = to_bcd(address / 75 / 60);
+  header.seconds = to_bcd(address / 75 % 60);
+  header.sectors = to_bcd(address % 75);
+  header.mode = sector_mode_2;
+  header.file_num = file_num;
+  header.channel_num = channel_num;
+  header.submode = submode;
+  header.coding_info = coding_info;
+  memcpy(&sector[sync_pattern.size()], &header, sizeof(header));
+  // the subheader is stored twice
+  memcpy(&sector[sync_pattern.size() + sizeof(header)], &header.file_num, 4);
+  return sector;
+}
+
+void append_directory_record(std::vector<mode2_form1_data> &extent,
+                             size_t &offset, const std::string &name,
+                             uint32_t address, uint32_t size,
+                             uint16_t attributes, uint8_t file_number) {
+  const size_t record_size = sizeof(directory_entry) + name.size() +
+                             ((name.size() & 1) ? 0 : 1) +
+                             sizeof(directory_entry_ex);
+  // records do not cross block boundaries
+  if (extent.empty() || offset + record_size > mode2_form1_data_size) {
+    extent.emplace_back();
+    extent.back().fill(0);
+    offset = 0;
+  }
+
+  uint8_t *record = &extent.back()[offset];
+  directory_entry entry = {};
+  entry.entry_len = static_cast<uint8_t>(record_size);
+  entry.file_address = util::swap_byte_order(address);
+  entry.file_size = util::swap_byte_order(size);
+  entry.name_len = static_cast<uint8_t>(name.size());
+  memcpy(record, &entry, sizeof(entry));
+  memcpy(record + sizeof(entry), name.data(), name.size());
+
+  directory_entry_ex entry_ex = {};
+  entry_ex.file_attr = attributes;
+  entry_ex.file_number = file_number;
+  memcpy(record + record_size - sizeof(entry_ex), &entry_ex,
+         sizeof(entry_ex));
+
+  offset += record_size;
+}
+
+uint32_t write_synthetic_image(const image_options &options,
+                               const std::string &path) {
+  std::mt19937 rng(options.seed);
+
+  // the path table is keyed by directory name, so names are unique disc-wide
+  std::vector<directory_node> dirs(1);
+  dirs[0].name = std::string(1, '\0');
+  size_t level_begin = 0;
+  for (unsigned depth = 0; depth < options.directory_depth; ++depth) {
+    const size_t level_end = dirs.size();
+    for (size_t parent = level_begin; parent < level_end; ++parent) {
+      for (unsigned i = 0; i < options.directory_fanout; ++i) {
+        directory_node dir;
+        dir.name = (boost::format("DIR%04u") % dirs.size()).str();
+        dir.parent = static_cast<uint32_t>(parent);
+        dirs[parent].children.push_back(static_cast<uint32_t>(dirs.size()));
+        dirs.push_back(std::move(dir));
+      }
+    }
+    level_begin = level_end;
+  }
+
+  std::vector<file_node> files;
+  for (size_t d = 0; d < dirs.size(); ++d) {
+    for (unsigned i = 0; i < options.files_per_directory; ++i) {
+      file_node file;
+      file.name = (boost::format("FILE%04u.DAT") % files.size()).str();
+      file.size = static_cast<uint32_t>(1 + rng() % options.max_file_size);
+      file.sectors = blocks_for(file.size);
+      dirs[d].files.push_back(static_cast<uint32_t>(files.size()));
+      files.push_back(std::move(file));
+    }
+  }
+  const size_t plain_files = files.size();
+  for (unsigned i = 0; i < options.realtime_files; ++i) {
+    file_node file;
+    file.name = (boost::format("MOVIE%02u.RTF") % i).str();
+    // deepest directories first
+    dirs[dirs.size() - 1 - i % dirs.size()].files.push_back(
+        static_cast<uint32_t>(files.size()));
+    files.push_back(std::move(file));
+  }
+
+  // record sizes do not depend on addresses, so a first pass sizes extents
+  for (size_t d = 0; d < dirs.size(); ++d) {
+    fill_directory_extent(dirs, d, files);
+  }
+  const size_t path_table_size = make_path_table(dirs).size();
+
+  uint32_t block = path_table_block + blocks_for(path_table_size);
+  for (auto &dir : dirs) {
+    dir.address = block;
+    block += static_cast<uint32_t>(dir.extent.size());
+  }
+  for (size_t f = 0; f < plain_files; ++f) {
+    files[f].address = block;
+    block += files[f].sectors;
+  }
+  if (options.realtime_files) {
+    const uint32_t budget =
+        options.sectors > block ? options.sectors - block : 0;
+    const uint32_t per_file =
+        std::max<uint32_t>(64, budget / options.realtime_files);
+    const unsigned channels = std::max(1u, options.realtime_channels);
+    for (size_t f = plain_files; f < files.size(); ++f) {
+      auto &file = files[f];
+      file.address = block;
+      file.realtime = plan_realtime_file(rng, per_file, channels);
+      file.sectors = per_file;
+      for (const auto &s : file.realtime) {
+        file.size += (s.submode & submode::form) ? mode2_form2_data_size
+                                                 : mode2_form1_data_size;
+      }
+      block += per_file;
+    }
+  }
+  const uint32_t total = block;
+
+  for (size_t d = 0; d < dirs.size(); ++d) {
+    fill_directory_extent(dirs, d, files);
+  }
+  auto path_table = make_path_table(dirs);
+  path_table.resize(blocks_for(path_table.size()) * mode2_form1_data_size);
+
+  // a file that loses a sector is read one sector past its end, so the last
+  // file is left intact for that read to stay inside the image
+  std::set<uint32_t> damaged;
+  if (!files.empty()) {
+    const uint32_t begin = files.front().address;
+    const uint32_t end = files.back().address;
+    while (end > begin &&
+           damaged.size() <
+               std::min<size_t>(options.damaged_sectors, end - begin)) {
+      damaged.insert(begin + rng() % (end - begin));
+    }
+  }
+
+  image_writer out(path, static_cast<uint64_t>(total) * sector_size,
+                   std::move(damaged), options.seed);
+
+  while (out.block() < label_block) {
+    out.add(0, 0, submode::form, 0);
+  }
+
+  disc_label label = {};
+  label.record_type = 1;
+  memcpy(label.volume_structure_standard_id, "CD-I ", 5);
+  label.volume_structure_version = 1;
+  memset(label.system_id, ' ', sizeof(label.system_id));
+  memcpy(label.system_id, "CD-RTOS", 7);
+  memset(label.volume_id, ' ', sizeof(label.volume_id));
+  memcpy(label.volume_id, "SYNTHETIC", 9);
+  label.volume_space_size = util::swap_byte_order(total);
+  label.path_table_size =
+      util::swap_byte_order(static_cast<uint32_t>(path_table_size));
+  label.path_table_address = util::swap_byte_order(path_table_block);
+  out.add(0, 0, submode::data | submode::eor, 0, &label);
+
+  disc_label_terminator terminator = {};
+  terminator.record_type = 255;
+  memcpy(terminator.volume_structure_standard_id, "CD-I ", 5);
+  terminator.volume_structure_version = 1;
+  out.add(0, 0, submode::data | submode::eor, 0, &terminator);
+
+  // extents end with an EOF sector
+  const auto add_extent = [&out](const uint8_t *data, size_t blocks) {
+    for (size_t i = 0; i < blocks; ++i) {
+      const uint8_t last =
+          i + 1 == blocks ? submode::eor | submode::eof : 0;
+      out.add(0, 0, submode::data | last, 0,
+              data + i * mode2_form1_data_size);
+    }
+  };
+  add_extent(path_table.data(), path_table.size() / mode2_form1_data_size);
+  for (const auto &dir : dirs) {
+    add_extent(dir.extent.front().data(), dir.extent.size());
+  }
+
+  for (size_t f = 0; f < plain_files; ++f) {
+    // plain file data is the noise make_sector leaves in the data area
+    for (uint32_t i = 0; i < files[f].sectors; ++i) {
+      const uint8_t last =
+          i + 1 == files[f].sectors ? submode::eor | submode::eof : 0;
+      out.add(0, 0, submode::data | last, 0);
+    }
+  }
+
+  for (size_t f = plain_files; f < files.size(); ++f) {
+    for (const auto &s : files[f].realtime) {
+      out.add(1, s.channel_num, s.submode, s.coding_info);
+    }
+  }
+
+  return out.close() ? total : 0;
+}
+
+} // namespace bench
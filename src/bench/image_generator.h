@@ -0,0 +1,57 @@
+//
+//  image_generator.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "cdi_lib/sector.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+struct image_options {
+  unsigned seed = 1;
+  // approximate number of sectors; real-time files take up whatever the
+  // filesystem and plain files leave
+  uint32_t sectors = 20000;
+  // levels of directories below the root and subdirectories per directory
+  unsigned directory_depth = 4;
+  unsigned directory_fanout = 2;
+  unsigned files_per_directory = 3;
+  size_t max_file_size = 64 * 1024;
+  // each real-time file interleaves this many channels each of MPEG video,
+  // MPEG audio, ADPCM audio and DYUV images
+  unsigned realtime_files = 4;
+  unsigned realtime_channels = 4;
+  // file sectors overwritten with noise, each followed by a few stray bytes
+  // that shift the rest of the image out of sector alignment
+  unsigned damaged_sectors = 0;
+};
+
+// Writes a scrambled mode 2 track image with a disc label, path table,
+// directory tree, plain files and interleaved real-time files. Returns the
+// number of sectors written, or 0 if the file could not be written.
+uint32_t write_synthetic_image(const image_options &options,
+                               const std::string &path);
+
+// Unscrambled mode 2 sector at block with the subheader filled in and the
+// rest of the sector filled with noise from seed
+cd_i::sector_data make_sector(uint32_t block, uint8_t file_num,
+                              uint8_t channel_num, uint8_t submode,
+                              uint8_t coding_info, unsigned seed);
+
+// Appends a directory record to a directory extent, starting a new block if
+// the record does not fit in the current one
+void append_directory_record(std::vector<cd_i::mode2_form1_data> &extent,
+                             size_t &offset, const std::string &name,
+                             uint32_t address, uint32_t size,
+                             uint16_t attributes, uint8_t file_number);
+
+} // namespace bench
@@ -0,0 +1,298 @@
+//
+//  perf.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "image_generator.h"
+
+#include <boost/filesystem.hpp>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = boost::filesystem;
+
+namespace {
+
+struct perf_options {
+  std::string cdix_path;
+  uint32_t sectors = 20000;
+  unsigned repeat = 3;
+  std::string baseline_path;
+  bool save_baseline = false;
+  double tolerance = 0.1;
+  bool json = false;
+};
+
+struct measurement {
+  std::string name;
+  double seconds = 0;
+  double sectors_per_second = 0;
+  long peak_rss_kb = 0;
+};
+
+struct baseline_entry {
+  double sectors_per_second;
+  long peak_rss_kb;
+};
+
+const std::vector<std::string> commands = {
+    "print",        "extract-files", "extract-mpegs",  "extract-audio",
+    "extract-dyuv", "extract-clut",  "extract-rgb555", "extract-all",
+};
+
+// Runs cdix with its output discarded; false if it did not exit with 0
+bool run_cdix(const std::vector<std::string> &args, double &seconds,
+              long &peak_rss_kb) {
+  using clock = std::chrono::steady_clock;
+
+  std::vector<char *> argv;
+  for (const auto &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  const auto start = clock::now();
+  const pid_t pid = fork();
+  if (pid < 0) {
+    return false;
+  }
+  if (pid == 0) {
+    const int null = open("/dev/null", O_WRONLY);
+    dup2(null, STDOUT_FILENO);
+    dup2(null, STDERR_FILENO);
+    execv(argv[0], argv.data());
+    _exit(127);
+  }
+
+  int status = 0;
+  struct rusage usage = {};
+  if (wait4(pid, &status, 0, &usage) != pid) {
+    return false;
+  }
+  seconds = std::chrono::duration<double>(clock::now() - start).count();
+#ifdef __APPLE__
+  peak_rss_kb = usage.ru_maxrss / 1024;
+#else
+  peak_rss_kb = usage.ru_maxrss;
+#endif
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+std::map<std::string, baseline_entry> load_baseline(const std::string &path) {
+  std::map<std::string, baseline_entry> baseline;
+  std::ifstream in(path);
+  std::string name;
+  baseline_entry entry;
+  while (in >> name >> entry.sectors_per_second >> entry.peak_rss_kb) {
+    baseline[name] = entry;
+  }
+  return baseline;
+}
+
+bool save_baseline(const std::string &path,
+                   const std::vector<measurement> &results) {
+  std::ofstream out(path);
+  for (const auto &m : results) {
+    out << m.name << " " << static_cast<uint64_t>(m.sectors_per_second) << " "
+        << m.peak_rss_kb << "\n";
+  }
+  return static_cast<bool>(out);
+}
+
+// Reports results that are worse than the baseline by more than the
+// tolerance; true if there are none
+bool compare_to_baseline(const std::map<std::string, baseline_entry> &baseline,
+                         const std::vector<measurement> &results,
+                         double tolerance) {
+  bool passed = true;
+  for (const auto &m : results) {
+    const auto found = baseline.find(m.name);
+    if (found == baseline.end()) {
+      continue;
+    }
+    const auto &base = found->second;
+    if (m.sectors_per_second < base.sectors_per_second * (1 - tolerance)) {
+      fprintf(stderr, "REGRESSION %s: %.0f sectors/s, baseline %.0f\n",
+              m.name.c_str(), m.sectors_per_second, base.sectors_per_second);
+      passed = false;
+    }
+    if (m.peak_rss_kb > base.peak_rss_kb * (1 + tolerance)) {
+      fprintf(stderr, "REGRESSION %s: peak RSS %ld KiB, baseline %ld KiB\n",
+              m.name.c_str(), m.peak_rss_kb, base.peak_rss_kb);
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+void print_json(const perf_options &options,
+                const std::vector<measurement> &results) {
+  printf("{\n");
+  printf("  \"context\": {\n");
+  printf("    \"sectors\": %u,\n", options.sectors);
+  printf("    \"repeat\": %u\n", options.repeat);
+  printf("  },\n");
+  printf("  \"runs\": [");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &m = results[i];
+    printf("%s\n    {\n", i ? "," : "");
+    printf("      \"name\": \"%s\",\n", m.name.c_str());
+    printf("      \"wall_time_s\": %.3f,\n", m.seconds);
+    printf("      \"sectors_per_second\": %.0f,\n", m.sectors_per_second);
+    printf("      \"peak_rss_kb\": %ld\n", m.peak_rss_kb);
+    printf("    }");
+  }
+  printf("\n  ]\n}\n");
+}
+
+bool parse_arguments(int argc, const char *argv[], perf_options &options) {
+  options.cdix_path =
+      (fs::path(argv[0]).parent_path() / "cdix").string();
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const auto value = [&arg](const char *prefix) {
+      return arg.substr(std::string(prefix).size());
+    };
+    if (arg.compare(0, 7, "--cdix=") == 0) {
+      options.cdix_path = value("--cdix=");
+    } else if (arg.compare(0, 10, "--sectors=") == 0) {
+      options.sectors = std::strtoul(value("--sectors=").c_str(), nullptr, 0);
+    } else if (arg.compare(0, 9, "--repeat=") == 0) {
+      options.repeat = std::strtoul(value("--repeat=").c_str(), nullptr, 0);
+    } else if (arg.compare(0, 11, "--baseline=") == 0) {
+      options.baseline_path = value("--baseline=");
+    } else if (arg == "--save-baseline") {
+      options.save_baseline = true;
+    } else if (arg.compare(0, 12, "--tolerance=") == 0) {
+      options.tolerance = std::strtod(value("--tolerance=").c_str(), nullptr);
+    } else if (arg == "--json") {
+      options.json = true;
+    } else {
+      fprintf(stderr,
+              "Usage: %s [--cdix=<path>] [--sectors=<n>] [--repeat=<n>] "
+              "[--baseline=<path> [--save-baseline]] [--tolerance=<fraction>] "
+              "[--json]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  if (options.save_baseline && options.baseline_path.empty()) {
+    fprintf(stderr, "--save-baseline needs --baseline\n");
+    return false;
+  }
+  options.repeat = std::max(1u, options.repeat);
+  return true;
+}
+
+} // namespace
+
+// Runs every cdix command over a clean and a damaged synthetic image and
+// records the best wall time and peak RSS of each. With --baseline they are
+// checked against a file written by an earlier --save-baseline run; none is
+// kept in the repository, see the perf-baseline and perf-check targets.
+int main(int argc, const char *argv[]) {
+  perf_options options;
+  if (!parse_arguments(argc, argv, options)) {
+    return 1;
+  }
+
+  const auto work_dir =
+      fs::temp_directory_path() / fs::unique_path("cdix_perf-%%%%%%%%");
+  fs::create_directories(work_dir);
+
+  struct image {
+    std::string name;
+    bench::image_options options;
+    // extra cdix arguments
+    std::vector<std::string> args;
+  };
+  std::vector<image> images(2);
+  images[0].name = "clean";
+  images[1].name = "damaged";
+  images[1].options.damaged_sectors = std::max(1u, options.sectors / 2000);
+  images[1].args = {"--resync"};
+
+  std::vector<measurement> results;
+  bool failed = false;
+  for (auto &img : images) {
+    img.options.sectors = options.sectors;
+    const auto image_path = (work_dir / (img.name + ".raw")).string();
+    const auto sectors = bench::write_synthetic_image(img.options, image_path);
+    if (!sectors) {
+      fprintf(stderr, "error writing %s\n", image_path.c_str());
+      failed = true;
+      break;
+    }
+
+    for (const auto &command : commands) {
+      measurement m;
+      m.name = img.name + "/" + command;
+      for (unsigned r = 0; r < options.repeat; ++r) {
+        const auto output_path = work_dir / "out";
+        fs::remove_all(output_path);
+        fs::create_directories(output_path);
+
+        std::vector<std::string> args = {options.cdix_path, command};
+        args.insert(args.end(), img.args.begin(), img.args.end());
+        args.push_back(image_path);
+        args.push_back(output_path.string());
+
+        double seconds = 0;
+        long peak_rss_kb = 0;
+        if (!run_cdix(args, seconds, peak_rss_kb)) {
+          fprintf(stderr, "%s: cdix failed\n", m.name.c_str());
+          failed = true;
+          break;
+        }
+        if (r == 0 || seconds < m.seconds) {
+          m.seconds = seconds;
+        }
+        m.peak_rss_kb = std::max(m.peak_rss_kb, peak_rss_kb);
+      }
+      m.sectors_per_second = m.seconds > 0 ? sectors / m.seconds : 0;
+
+      fprintf(options.json ? stderr : stdout,
+              "%-30s %8.3f s %12.0f sectors/s %10ld KiB\n", m.name.c_str(),
+              m.seconds, m.sectors_per_second, m.peak_rss_kb);
+      results.push_back(m);
+    }
+  }
+  fs::remove_all(work_dir);
+
+  if (options.json) {
+    print_json(options, results);
+  }
+  if (failed) {
+    return 1;
+  }
+
+  if (options.save_baseline) {
+    if (!save_baseline(options.baseline_path, results)) {
+      fprintf(stderr, "error writing %s\n", options.baseline_path.c_str());
+      return 1;
+    }
+  } else if (!options.baseline_path.empty()) {
+    const auto baseline = load_baseline(options.baseline_path);
+    if (baseline.empty()) {
+      // passing with nothing to compare against would hide regressions
+      fprintf(stderr, "no baseline in %s; run with --save-baseline first\n",
+              options.baseline_path.c_str());
+      return 1;
+    }
+    if (!compare_to_baseline(baseline, results, options.tolerance)) {
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+//
+//  file_sink.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "file_sink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace cd_i {
+
+namespace {
+
+constexpr size_t page_size = 4096;
+
+size_t round_up_to_page(size_t size) {
+  return (size + page_size - 1) / page_size * page_size;
+}
+
+} // namespace
+
+file_sink::file_sink(const std::string &path, uint64_t expected_size /*= 0*/,
+                     size_t buffer_size /*= default_buffer_size*/) {
+  fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    failed_ = true;
+    return;
+  }
+
+  if (expected_size) {
+#ifdef __linux__
+    // best effort: not every filesystem supports it, and KEEP_SIZE leaves the
+    // file length to the data actually written
+    fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(expected_size));
+#endif
+    // small files need no more than their own size
+    buffer_size =
+        std::min<uint64_t>(buffer_size, std::max<uint64_t>(expected_size, 1));
+  }
+
+  capacity_ = round_up_to_page(std::max<size_t>(buffer_size, 1));
+  buffer_.reset(
+      static_cast<uint8_t *>(std::aligned_alloc(page_size, capacity_)));
+  if (!buffer_) {
+    capacity_ = 0;
+  }
+}
+
+file_sink::~file_sink() { close(); }
+
+void file_sink::write(const void *data, size_t size) {
+  if (failed_ || size == 0) {
+    return;
+  }
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  if (used_ + size > capacity_) {
+    flush();
+    // writes that would not fit anyway skip the buffer
+    if (size >= capacity_) {
+      write_through(bytes, size);
+      return;
+    }
+  }
+  std::memcpy(buffer_.get() + used_, bytes, size);
+  used_ += size;
+}
+
+void file_sink::write_at(uint64_t offset, const void *data, size_t size) {
+  if (failed_) {
+    return;
+  }
+
+  flush();
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  while (size && !failed_) {
+    const ssize_t written =
+        ::pwrite(fd_, bytes, size, static_cast<off_t>(offset));
+    if (written < 0) {
+      if (errno != EINTR) {
+        failed_ = true;
+      }
+      continue;
+    }
+    bytes += written;
+    offset += static_cast<uint64_t>(written);
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void file_sink::flush() {
+  if (used_) {
+    write_through(buffer_.get(), used_);
+    used_ = 0;
+  }
+}
+
+void file_sink::write_through(const uint8_t *data, size_t size) {
+  while (size && !failed_) {
+    const ssize_t written = ::write(fd_, data, size);
+    if (written < 0) {
+      if (errno != EINTR) {
+        failed_ = true;
+      }
+      continue;
+    }
+    data += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+bool file_sink::close() {
+  if (fd_ >= 0) {
+    flush();
+    if (::close(fd_) != 0) {
+      failed_ = true;
+    }
+    fd_ = -1;
+  }
+  return !failed_;
+}
+
+} // namespace cd_i
@@ -0,0 +1,63 @@
+//
+//  file_sink.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+namespace cd_i {
+
+// Output file written through a large page-aligned buffer in batches. If the
+// final size is known up front, the file is preallocated so that it is laid
+// out in one piece.
+//
+// Like std::ofstream, a sink that fails to open or write only records the
+// failure; close() reports it.
+class file_sink {
+public:
+  static constexpr size_t default_buffer_size = 256 * 1024;
+
+  explicit file_sink(const std::string &path, uint64_t expected_size = 0,
+                     size_t buffer_size = default_buffer_size);
+  // Flushes what is buffered, ignoring errors
+  ~file_sink();
+
+  file_sink(const file_sink &) = delete;
+  file_sink &operator=(const file_sink &) = delete;
+
+  void write(const void *data, size_t size);
+  // Overwrites data that has already been written, e.g. a header whose fields
+  // are only known at the end
+  void write_at(uint64_t offset, const void *data, size_t size);
+  // Flushes and closes the file; false if anything failed since opening
+  bool close();
+
+  bool failed() const;
+
+private:
+  void flush();
+  void write_through(const uint8_t *data, size_t size);
+
+private:
+  struct free_deleter {
+    void operator()(uint8_t *p) const { std::free(p); }
+  };
+
+  int fd_ = -1;
+  bool failed_ = false;
+  std::unique_ptr<uint8_t, free_deleter> buffer_;
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+};
+
+inline bool file_sink::failed() const { return failed_; }
+
+} // namespace cd_i
@@ -0,0 +1,248 @@
+//
+//  index.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "index.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+
+#include <cstdlib>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cd_i {
+
+namespace {
+
+constexpr char index_magic[4] = {'C', 'D', 'X', 'I'};
+constexpr uint32_t index_version = 2;
+
+// Number and size of the image slices hashed into the fingerprint
+constexpr size_t fingerprint_samples = 16;
+constexpr size_t fingerprint_sample_size = 64 * 1024;
+
+uint64_t fnv1a(uint64_t hash, const uint8_t *data, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Hashes the modification time and evenly spaced slices of the image rather
+// than all of it, so checking an index stays cheap next to the scan it
+// replaces. A changed image that slips past this is still caught when the
+// sectors it reads do not match their indexed headers.
+bool image_fingerprint(const std::string &path, uint64_t &size,
+                       uint64_t &fingerprint) {
+  std::ifstream streamin(path, std::ios_base::binary);
+  if (!streamin) {
+    return false;
+  }
+  streamin.seekg(0, std::ios_base::end);
+  size = static_cast<uint64_t>(streamin.tellg());
+
+  boost::system::error_code error;
+  const int64_t mtime = static_cast<int64_t>(
+      boost::filesystem::last_write_time(path, error));
+  if (error) {
+    return false;
+  }
+
+  uint64_t hash = fnv1a(0xcbf29ce484222325ull,
+                        reinterpret_cast<const uint8_t *>(&size), sizeof(size));
+  hash = fnv1a(hash, reinterpret_cast<const uint8_t *>(&mtime), sizeof(mtime));
+  std::vector<uint8_t> sample(fingerprint_sample_size);
+  for (size_t i = 0; i < fingerprint_samples; ++i) {
+    const uint64_t offset =
+        size > sample.size()
+            ? (size - sample.size()) * i / (fingerprint_samples - 1)
+            : 0;
+    streamin.clear();
+    streamin.seekg(offset);
+    streamin.read(reinterpret_cast<char *>(sample.data()), sample.size());
+    hash = fnv1a(hash, sample.data(),
+                 static_cast<size_t>(streamin.gcount()));
+  }
+
+  fingerprint = hash;
+  return true;
+}
+
+template <typename T> void write_value(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+template <typename T> bool read_value(std::istream &in, T &value) {
+  return static_cast<bool>(
+      in.read(reinterpret_cast<char *>(&value), sizeof(value)));
+}
+
+template <typename T>
+void write_vector(std::ostream &out, const std::vector<T> &values) {
+  write_value(out, static_cast<uint32_t>(values.size()));
+  out.write(reinterpret_cast<const char *>(values.data()),
+            values.size() * sizeof(T));
+}
+
+// end is the length of the file, which bounds the count a damaged index can
+// claim
+template <typename T>
+bool read_vector(std::istream &in, uint64_t end, std::vector<T> &values) {
+  uint32_t size = 0;
+  if (!read_value(in, size)) {
+    return false;
+  }
+  const auto pos = static_cast<int64_t>(in.tellg());
+  if (pos < 0 || static_cast<uint64_t>(pos) > end ||
+      size > (end - static_cast<uint64_t>(pos)) / sizeof(T)) {
+    return false;
+  }
+  values.resize(size);
+  return static_cast<bool>(in.read(reinterpret_cast<char *>(values.data()),
+                                   values.size() * sizeof(T)));
+}
+
+} // namespace
+
+std::string sector_index::sidecar_path(const std::string &image_path) {
+  return image_path + ".cdxi";
+}
+
+bool sector_index::scan_image(const std::string &image_path,
+                              const reader_options &options) {
+  if (!image_fingerprint(image_path, image_size_, fingerprint_)) {
+    return false;
+  }
+
+  // a reader of its own, as running to the end of the image closes it
+  disc_sequential_reader reader(image_path, options);
+  headers_.clear();
+
+  sector_batch batch(options.batch_size);
+  while (reader.fetch_sectors(batch)) {
+    for (size_t i = 0; i < batch.size(); ++i) {
+      const uint32_t block = batch.block(i);
+      if (headers_.empty()) {
+        first_block_ = block;
+      }
+      if (block < first_block_) {
+        continue;
+      }
+      const size_t slot = block - first_block_;
+      if (slot >= headers_.size()) {
+        headers_.resize(slot + 1, sector_header{});
+      }
+      headers_[slot] = batch.header(i);
+    }
+  }
+  return !headers_.empty();
+}
+
+bool sector_index::load(const std::string &image_path) {
+  std::ifstream streamin(sidecar_path(image_path), std::ios_base::binary);
+  if (!streamin) {
+    return false;
+  }
+  streamin.seekg(0, std::ios_base::end);
+  const auto end = static_cast<int64_t>(streamin.tellg());
+  streamin.seekg(0);
+  if (end < 0) {
+    return false;
+  }
+
+  char magic[sizeof(index_magic)];
+  uint32_t version = 0;
+  if (!read_value(streamin, magic) ||
+      !std::equal(magic, magic + sizeof(magic), index_magic) ||
+      !read_value(streamin, version) || version != index_version) {
+    return false;
+  }
+
+  uint64_t image_size = 0;
+  uint64_t fingerprint = 0;
+  if (!read_value(streamin, image_size_) ||
+      !read_value(streamin, fingerprint_) ||
+      !image_fingerprint(image_path, image_size, fingerprint) ||
+      image_size != image_size_ || fingerprint != fingerprint_) {
+    return false;
+  }
+
+  uint32_t num_directories = 0;
+  if (!read_value(streamin, first_block_) ||
+      !read_vector(streamin, end, headers_) ||
+      !read_vector(streamin, end, disc_labels_) ||
+      !read_vector(streamin, end, path_table_) ||
+      !read_value(streamin, num_directories)) {
+    return false;
+  }
+  // every image an index is saved for has these, and readers rely on them
+  if (headers_.empty() || disc_labels_.empty() || path_table_.empty()) {
+    return false;
+  }
+
+  directories_.clear();
+  for (uint32_t i = 0; i < num_directories; ++i) {
+    uint32_t address = 0;
+    if (!read_value(streamin, address) ||
+        !read_vector(streamin, end, directories_[address])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sector_index::save(const std::string &image_path) const {
+  const std::string path = sidecar_path(image_path);
+  // a name of its own, as other runs may be saving an index for the same image
+  std::string temp_path = path + ".XXXXXX";
+  const int fd = mkstemp(&temp_path[0]);
+  if (fd < 0) {
+    return false;
+  }
+  // mkstemp creates the file readable by its owner only
+  fchmod(fd, 0644);
+  ::close(fd);
+  {
+    std::ofstream streamout(temp_path, std::ios_base::binary);
+    if (!streamout) {
+      return false;
+    }
+
+    streamout.write(index_magic, sizeof(index_magic));
+    write_value(streamout, index_version);
+    write_value(streamout, image_size_);
+    write_value(streamout, fingerprint_);
+    write_value(streamout, first_block_);
+    write_vector(streamout, headers_);
+    write_vector(streamout, disc_labels_);
+    write_vector(streamout, path_table_);
+    write_value(streamout, static_cast<uint32_t>(directories_.size()));
+    for (const auto &pair : directories_) {
+      write_value(streamout, pair.first);
+      write_vector(streamout, pair.second);
+    }
+
+    if (!streamout) {
+      streamout.close();
+      boost::system::error_code error;
+      boost::filesystem::remove(temp_path, error);
+      return false;
+    }
+  }
+
+  // replace atomically so concurrent runs never see a partial index
+  boost::system::error_code error;
+  boost::filesystem::rename(temp_path, path, error);
+  if (error) {
+    boost::filesystem::remove(temp_path, error);
+    return false;
+  }
+  return true;
+}
+
+} // namespace cd_i
@@ -0,0 +1,119 @@
+//
+//  index.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "structure.h"
+
+#include <cstring>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace cd_i {
+
+// Thrown when a sector read from the image differs from its indexed header,
+// which means the image changed after the index was saved. Unlike other read
+// errors it is never taken for the end of the disc.
+class index_mismatch_error : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Sidecar index of an image: the unscrambled header of every sector plus the
+// disc labels, path table and directory contents, so that later runs can go
+// straight to the sectors they need.
+//
+// The file stores host-endian integers and is tied to its image by the image
+// size and a fingerprint of its modification time and sampled contents.
+// Readers also compare every sector they read against its indexed header.
+class sector_index {
+public:
+  static std::string sidecar_path(const std::string &image_path);
+
+  // Returns false if the sidecar is missing, unreadable or stale
+  bool load(const std::string &image_path);
+  bool save(const std::string &image_path) const;
+
+  // Records image size, fingerprint and all sector headers
+  bool scan_image(const std::string &image_path,
+                  const reader_options &options);
+
+  // Returns nullptr for blocks that are not in the image
+  const sector_header *header(uint32_t block) const;
+  // False if the index has a different header for the block
+  bool matches(uint32_t block, const sector_header &header) const;
+
+  const std::vector<disc_label> &disc_labels() const;
+  const std::vector<mode2_form1_data> &path_table() const;
+  // Returns nullptr if the directory is not in the index
+  const std::vector<mode2_form1_data> *directory(uint32_t address) const;
+
+  void set_disc_labels(const std::vector<disc_label> &labels);
+  void set_path_table(const std::vector<mode2_form1_data> &raw_data);
+  void add_directory(uint32_t address,
+                     const std::vector<mode2_form1_data> &raw_data);
+
+private:
+  uint64_t image_size_ = 0;
+  uint64_t fingerprint_ = 0;
+  uint32_t first_block_ = 0;
+  std::vector<sector_header> headers_;
+  std::vector<disc_label> disc_labels_;
+  std::vector<mode2_form1_data> path_table_;
+  std::map<uint32_t, std::vector<mode2_form1_data>> directories_;
+};
+
+inline const sector_header *sector_index::header(uint32_t block) const {
+  if (block < first_block_ || block - first_block_ >= headers_.size()) {
+    return nullptr;
+  }
+  const sector_header &found = headers_[block - first_block_];
+  // gaps left by damaged regions have no mode
+  return found.mode ? &found : nullptr;
+}
+
+inline bool sector_index::matches(uint32_t block,
+                                  const sector_header &header) const {
+  const sector_header *indexed = sector_index::header(block);
+  return !indexed ||
+         std::memcmp(indexed, &header, sizeof(sector_header)) == 0;
+}
+
+inline const std::vector<disc_label> &sector_index::disc_labels() const {
+  return disc_labels_;
+}
+
+inline const std::vector<mode2_form1_data> &sector_index::path_table() const {
+  return path_table_;
+}
+
+inline const std::vector<mode2_form1_data> *
+sector_index::directory(uint32_t address) const {
+  const auto found = directories_.find(address);
+  return found == directories_.end() ? nullptr : &found->second;
+}
+
+inline void
+sector_index::set_disc_labels(const std::vector<disc_label> &labels) {
+  disc_labels_ = labels;
+}
+
+inline void
+sector_index::set_path_table(const std::vector<mode2_form1_data> &raw_data) {
+  path_table_ = raw_data;
+}
+
+inline void
+sector_index::add_directory(uint32_t address,
+                            const std::vector<mode2_form1_data> &raw_data) {
+  directories_[address] = raw_data;
+}
+
+} // namespace cd_i
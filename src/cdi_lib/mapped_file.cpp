@@ -0,0 +1,67 @@
+//
+//  mapped_file.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cd_i {
+
+std::unique_ptr<mapped_file> mapped_file::open(const std::string &path,
+                                               bool huge_pages /*= false*/) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    ::close(fd);
+    return nullptr;
+  }
+
+  const size_t size = static_cast<size_t>(st.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // the mapping keeps its own reference to the file
+  ::close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+
+  madvise(data, size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+  if (huge_pages) {
+    madvise(data, size, MADV_HUGEPAGE);
+  }
+#else
+  (void)huge_pages;
+#endif
+
+  return std::unique_ptr<mapped_file>(
+      new mapped_file(static_cast<const uint8_t *>(data), size));
+}
+
+void mapped_file::will_need(size_t offset, size_t size) const {
+  if (offset >= size_) {
+    return;
+  }
+  const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  const size_t begin = offset - offset % page_size;
+  const size_t end = std::min(size_, offset + size);
+  madvise(const_cast<uint8_t *>(data_) + begin, end - begin, MADV_WILLNEED);
+}
+
+mapped_file::~mapped_file() {
+  munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+} // namespace cd_i
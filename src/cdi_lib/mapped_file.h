@@ -0,0 +1,50 @@
+//
+//  mapped_file.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace cd_i {
+
+// Read-only memory mapping of a whole file
+class mapped_file {
+public:
+  // Returns nullptr if the file cannot be mapped (e.g. it is a pipe)
+  static std::unique_ptr<mapped_file> open(const std::string &path,
+                                           bool huge_pages = false);
+
+  ~mapped_file();
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+
+  const uint8_t *data() const;
+  size_t size() const;
+
+  // Asks the kernel to start reading a range in the background
+  void will_need(size_t offset, size_t size) const;
+
+private:
+  mapped_file(const uint8_t *data, size_t size);
+
+private:
+  const uint8_t *data_;
+  size_t size_;
+};
+
+inline mapped_file::mapped_file(const uint8_t *data, size_t size)
+    : data_(data), size_(size) {}
+
+inline const uint8_t *mapped_file::data() const { return data_; }
+
+inline size_t mapped_file::size() const { return size_; }
+
+} // namespace cd_i
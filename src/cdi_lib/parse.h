@@ -9,6 +9,7 @@
 #pragma once
 
 #include "media.h"
+#include "sector_filter.h"
 #include "structure.h"
 
 #include <cassert>
@@ -49,7 +50,7 @@ inline bool is_mode2_sector(const sector_data &sector) {
 }
 
 inline bool is_mode2_form1_sector(const sector_header &header) {
-  return is_mode2_sector(header) && !(header.submode & submode::form);
+  return filters::form1(header);
 }
 
 inline bool is_mode2_form1_sector(const sector_data &sector) {
@@ -57,8 +58,7 @@ inline bool is_mode2_form1_sector(const sector_data &sector) {
 }
 
 inline bool is_mode2_form2_sector(const sector_header &header) {
-  assert(header.mode == sector_mode_1 || header.mode == sector_mode_2);
-  return is_mode2_sector(header) && (header.submode & submode::form);
+  return filters::form2(header);
 }
 
 inline bool is_mode2_form2_sector(const sector_data &sector) {
@@ -66,7 +66,7 @@ inline bool is_mode2_form2_sector(const sector_data &sector) {
 }
 
 inline bool is_eof_sector(const sector_header &header) {
-  return is_mode2_sector(header) && (header.submode & submode::eof);
+  return filters::eof(header);
 }
 
 inline bool is_eof_sector(const sector_data &sector) {
@@ -74,8 +74,7 @@ inline bool is_eof_sector(const sector_data &sector) {
 }
 
 inline bool is_message_sector(const sector_header &header) {
-  return is_mode2_form2_sector(header) && header.file_num == 0 &&
-         header.channel_num == 0 && header.coding_info == 0;
+  return filters::message(header);
 }
 
 inline bool is_message_sector(const sector_data &sector) {
@@ -83,10 +82,7 @@ inline bool is_message_sector(const sector_data &sector) {
 }
 
 inline bool is_empty_sector(const sector_header &header) {
-  return is_mode2_sector(header) && header.channel_num == 0 &&
-         (header.submode & (submode::video | submode::audio | submode::data)) ==
-             0 &&
-         header.coding_info == 0;
+  return filters::empty(header);
 }
 
 inline bool is_empty_sector(const sector_data &sector) {
@@ -94,7 +90,7 @@ inline bool is_empty_sector(const sector_data &sector) {
 }
 
 inline bool is_audio_sector(const sector_header &header) {
-  return is_mode2_sector(header) && (header.submode & submode::audio) != 0;
+  return filters::audio(header);
 }
 
 inline bool is_audio_sector(const sector_data &sector) {
@@ -102,16 +98,24 @@ inline bool is_audio_sector(const sector_data &sector) {
 }
 
 inline bool is_mpeg_audio_sector(const sector_header &header) {
-  return is_audio_sector(header) &&
-         header.coding_info == audio_coding::audio_coding_MPEG;
+  return filters::mpeg_audio(header);
 }
 
 inline bool is_mpeg_audio_sector(const sector_data &sector) {
   return is_mpeg_audio_sector(get_sector_header(sector));
 }
 
+inline bool is_adpcm_audio_sector(const sector_header &header) {
+  return is_audio_sector(header) && is_mode2_form2_sector(header) &&
+         header.coding_info != audio_coding::audio_coding_MPEG;
+}
+
+inline bool is_adpcm_audio_sector(const sector_data &sector) {
+  return is_adpcm_audio_sector(get_sector_header(sector));
+}
+
 inline bool is_video_sector(const sector_header &header) {
-  return is_mode2_sector(header) && (header.submode & submode::video) != 0;
+  return filters::video(header);
 }
 
 inline bool is_video_sector(const sector_data &sector) {
@@ -119,8 +123,7 @@ inline bool is_video_sector(const sector_data &sector) {
 }
 
 inline bool is_mpeg_video_sector(const sector_header &header) {
-  return is_video_sector(header) &&
-         header.coding_info == video_coding::video_coding_MPEG;
+  return filters::mpeg_video(header);
 }
 
 inline bool is_mpeg_video_sector(const sector_data &sector) {
@@ -0,0 +1,211 @@
+//
+//  pipeline.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "pipeline.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace cd_i {
+
+namespace {
+
+enum slot_state : uint64_t {
+  slot_free,
+  slot_filled,
+  slot_ready,
+};
+
+// Slot states carry the sequence number they belong to, so that a stage that
+// is a lap ahead never mistakes an old state for the one it waits on
+uint64_t tag(uint64_t seq, slot_state state) { return seq * 3 + state; }
+
+// Where stages wait for a slot state. The stage that gets there next is
+// usually close behind, so a waiter spins, then yields, and only then goes to
+// sleep until the next state change.
+class slot_parking {
+public:
+  template <typename Ready> void wait(Ready ready) {
+    for (unsigned int spin = 0; spin < spins + yields; ++spin) {
+      if (ready()) {
+        return;
+      }
+      if (spin >= spins) {
+        std::this_thread::yield();
+      }
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    sleepers_.fetch_add(1, std::memory_order_relaxed);
+    // pairs with the fence in notify(): either it sees the sleeper or the
+    // check below sees the new state
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    cv_.wait(lock, ready);
+    sleepers_.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // Call after every state change that a stage may be waiting on
+  void notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleepers_.load(std::memory_order_relaxed)) {
+      // a sleeper holds the mutex from its last check until it waits
+      { std::lock_guard<std::mutex> lock(mutex_); }
+      cv_.notify_all();
+    }
+  }
+
+private:
+  static constexpr unsigned int spins = 64;
+  static constexpr unsigned int yields = 16;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::atomic<unsigned int> sleepers_{0};
+};
+
+} // namespace
+
+void run_pipeline(const pipeline_options &options,
+                  const std::function<bool(pipeline_slot &)> &produce,
+                  const std::function<void(pipeline_slot &)> &process,
+                  const std::function<void(const pipeline_slot &,
+                                           unsigned int)> &consume) {
+  const unsigned int workers = std::max(1u, options.workers);
+  const unsigned int writers = std::max(1u, options.writers);
+
+  // room for at least one end marker per worker
+  size_t ring_size = 1;
+  while (ring_size < std::max<size_t>(options.ring_size, workers + 1)) {
+    ring_size <<= 1;
+  }
+  const size_t mask = ring_size - 1;
+
+  std::vector<pipeline_slot> slots(ring_size);
+  std::unique_ptr<std::atomic<uint64_t>[]> states(
+      new std::atomic<uint64_t>[ring_size]);
+  // writers still to consume each slot
+  std::unique_ptr<std::atomic<uint32_t>[]> pending(
+      new std::atomic<uint32_t>[ring_size]);
+  for (size_t i = 0; i < ring_size; ++i) {
+    states[i].store(tag(i, slot_free), std::memory_order_relaxed);
+    pending[i].store(0, std::memory_order_relaxed);
+  }
+
+  slot_parking parking;
+  const auto publish = [&](size_t i, uint64_t state) {
+    states[i].store(state, std::memory_order_release);
+    parking.notify();
+  };
+
+  std::atomic<bool> failed(false);
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  const auto fail = [&](std::exception_ptr ex) {
+    std::lock_guard<std::mutex> lock(error_mutex);
+    if (!error) {
+      error = ex;
+    }
+    failed.store(true, std::memory_order_release);
+    parking.notify();
+  };
+
+  const auto wait_for = [&](uint64_t seq, slot_state state) {
+    const auto reached = [&] {
+      return states[seq & mask].load(std::memory_order_acquire) ==
+             tag(seq, state);
+    };
+    parking.wait(
+        [&] { return reached() || failed.load(std::memory_order_acquire); });
+    return reached();
+  };
+
+  std::vector<std::thread> threads;
+
+  for (unsigned int w = 0; w < workers; ++w) {
+    threads.emplace_back([&, w] {
+      try {
+        // workers take turns, so each slot is processed exactly once
+        for (uint64_t seq = w;; seq += workers) {
+          const size_t i = seq & mask;
+          if (!wait_for(seq, slot_filled)) {
+            return;
+          }
+          const bool end = slots[i].end;
+          if (!end) {
+            process(slots[i]);
+          }
+          publish(i, tag(seq, slot_ready));
+          if (end) {
+            return;
+          }
+        }
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    });
+  }
+
+  for (unsigned int k = 0; k < writers; ++k) {
+    threads.emplace_back([&, k] {
+      try {
+        for (uint64_t seq = 0;; ++seq) {
+          const size_t i = seq & mask;
+          if (!wait_for(seq, slot_ready) || slots[i].end) {
+            return;
+          }
+          consume(slots[i], k);
+          if (pending[i].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            // free for the sequence number one lap ahead
+            publish(i, tag(seq + ring_size, slot_free));
+          }
+        }
+      } catch (...) {
+        fail(std::current_exception());
+      }
+    });
+  }
+
+  uint64_t seq = 0;
+  try {
+    while (wait_for(seq, slot_free)) {
+      pipeline_slot &slot = slots[seq & mask];
+      if (!produce(slot)) {
+        break;
+      }
+      pending[seq & mask].store(writers, std::memory_order_relaxed);
+      publish(seq & mask, tag(seq, slot_filled));
+      ++seq;
+    }
+  } catch (...) {
+    fail(std::current_exception());
+  }
+
+  // one end marker for every worker; the first one also stops the writers
+  for (unsigned int w = 0; w < workers; ++w, ++seq) {
+    if (!wait_for(seq, slot_free)) {
+      break;
+    }
+    slots[seq & mask].end = true;
+    publish(seq & mask, tag(seq, slot_filled));
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace cd_i
@@ -0,0 +1,52 @@
+//
+//  pipeline.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "sweep.h"
+
+#include <functional>
+#include <vector>
+
+namespace cd_i {
+
+struct pipeline_options {
+  // threads descrambling sectors
+  unsigned int workers = 1;
+  // threads calling handlers; each file is always handled by the same one
+  unsigned int writers = 1;
+  // sectors in flight between the stages, rounded up to a power of two
+  size_t ring_size = 1024;
+};
+
+// Unit of work passed between the pipeline stages
+struct pipeline_slot {
+  // scrambled as filled in unless source is set, unscrambled once processed
+  sector_data sector;
+  // zero-copy scrambled sector that stays valid for the whole run
+  const sector_data *source = nullptr;
+  std::vector<file_sweep::delivery> deliveries;
+  std::vector<file_sweep::completion> completions;
+  bool end = false;
+};
+
+// Runs read -> process -> consume over a bounded ring of slots. produce runs
+// on the calling thread and returns false when there is nothing left; process
+// runs on the worker threads and consume on every writer thread. Each writer
+// sees every slot in production order. Slots are handed between stages
+// through per-slot atomic states; a stage whose slot is not ready spins
+// briefly and then sleeps until another stage changes a state.
+//
+// An exception thrown by any stage stops the pipeline and is rethrown here.
+void run_pipeline(const pipeline_options &options,
+                  const std::function<bool(pipeline_slot &)> &produce,
+                  const std::function<void(pipeline_slot &)> &process,
+                  const std::function<void(const pipeline_slot &,
+                                           unsigned int)> &consume);
+
+} // namespace cd_i
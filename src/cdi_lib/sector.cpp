@@ -7,89 +7,572 @@
 //
 
 #include "sector.h"
+#include "mapped_file.h"
 #include "parse.h"
+#include "stream_buffer.h"
 #include "util.h"
 
+#include <algorithm>
 #include <boost/format.hpp>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CDI_HAS_X86_SIMD 1
+#endif
 
 namespace cd_i {
 
-bool disc_sequential_reader::fetch_next_sector(sector_data &sector) {
-  if (done_) {
-    throw std::runtime_error("done parsing");
+namespace {
+
+enum class simd_level { scalar, sse2, avx2 };
+
+simd_level detect_simd_level() {
+#ifdef CDI_HAS_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return simd_level::avx2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return simd_level::sse2;
   }
+#endif
+  return simd_level::scalar;
+}
 
-  if (!streamin_) {
-    streamin_ = std::make_unique<std::ifstream>(path_, std::ios_base::binary);
+simd_level cpu_simd_level() {
+  static const simd_level level = detect_simd_level();
+  return level;
+}
+
+// All kernels allow in == out for in-place descrambling
+void xor_scramble_table_scalar(const uint8_t *in, uint8_t *out) {
+  for (size_t i = 0; i < scrambled_size; ++i) {
+    out[i] = in[i] ^ util::scramble_table[i];
+  }
+}
+
+const uint8_t *find_sync_pattern_scalar(const uint8_t *begin,
+                                        const uint8_t *end) {
+  return std::search(begin, end, sync_pattern.begin(), sync_pattern.end());
+}
+
+#ifdef CDI_HAS_X86_SIMD
+
+__attribute__((target("sse2"))) void
+xor_scramble_table_sse2(const uint8_t *in, uint8_t *out) {
+  const uint8_t *table = util::scramble_table.data();
+  size_t i = 0;
+  for (; i + 16 <= scrambled_size; i += 16) {
+    const __m128i d =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + i));
+    const __m128i t =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(table + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i),
+                     _mm_xor_si128(d, t));
+  }
+  for (; i < scrambled_size; ++i) {
+    out[i] = in[i] ^ table[i];
+  }
+}
 
-    size_t sync_ptr = 0;
+__attribute__((target("avx2"))) void
+xor_scramble_table_avx2(const uint8_t *in, uint8_t *out) {
+  const uint8_t *table = util::scramble_table.data();
+  size_t i = 0;
+  for (; i + 32 <= scrambled_size; i += 32) {
+    const __m256i d =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(in + i));
+    const __m256i t =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(table + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + i),
+                        _mm256_xor_si256(d, t));
+  }
+  for (; i < scrambled_size; ++i) {
+    out[i] = in[i] ^ table[i];
+  }
+}
 
-    while (*streamin_ && sync_ptr < sync_pattern.size()) {
-      const uint8_t byte = streamin_->get();
+// The sync pattern search compares whole blocks against the leading 0x00, the
+// 0xff run right after it and the trailing 0x00, and only checks the full
+// pattern at positions where all three match.
 
-      if (sync_pattern[sync_ptr] == byte) {
-        ++sync_ptr;
-      } else {
-        sync_ptr = 0;
+__attribute__((target("sse2"))) const uint8_t *
+find_sync_pattern_sse2(const uint8_t *begin, const uint8_t *end) {
+  constexpr size_t last_offset = sync_pattern.size() - 1;
+  const __m128i zeros = _mm_setzero_si128();
+  const __m128i ones = _mm_set1_epi8(-1);
+
+  const uint8_t *p = begin;
+  for (; end - p >= static_cast<ptrdiff_t>(16 + last_offset); p += 16) {
+    const __m128i first = _mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), zeros);
+    const __m128i second = _mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1)), ones);
+    const __m128i last = _mm_cmpeq_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + last_offset)),
+        zeros);
+    unsigned mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(first, second), last)));
+    while (mask) {
+      const uint8_t *candidate = p + __builtin_ctz(mask);
+      if (std::equal(sync_pattern.begin(), sync_pattern.end(), candidate)) {
+        return candidate;
       }
+      mask &= mask - 1;
     }
+  }
+  return find_sync_pattern_scalar(p, end);
+}
 
-    if (sync_ptr < sync_pattern.size()) {
-      return false;
+__attribute__((target("avx2"))) const uint8_t *
+find_sync_pattern_avx2(const uint8_t *begin, const uint8_t *end) {
+  constexpr size_t last_offset = sync_pattern.size() - 1;
+  const __m256i zeros = _mm256_setzero_si256();
+  const __m256i ones = _mm256_set1_epi8(-1);
+
+  const uint8_t *p = begin;
+  for (; end - p >= static_cast<ptrdiff_t>(32 + last_offset); p += 32) {
+    const __m256i first = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p)), zeros);
+    const __m256i second = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1)), ones);
+    const __m256i last = _mm256_cmpeq_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + last_offset)),
+        zeros);
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+        _mm256_and_si256(_mm256_and_si256(first, second), last)));
+    while (mask) {
+      const uint8_t *candidate = p + __builtin_ctz(mask);
+      if (std::equal(sync_pattern.begin(), sync_pattern.end(), candidate)) {
+        return candidate;
+      }
+      mask &= mask - 1;
     }
+  }
+  return find_sync_pattern_scalar(p, end);
+}
+
+#endif
+
+void xor_scramble_table(const uint8_t *in, uint8_t *out) {
+  switch (cpu_simd_level()) {
+#ifdef CDI_HAS_X86_SIMD
+  case simd_level::avx2:
+    return xor_scramble_table_avx2(in, out);
+  case simd_level::sse2:
+    return xor_scramble_table_sse2(in, out);
+#endif
+  default:
+    return xor_scramble_table_scalar(in, out);
+  }
+}
 
-    std::copy(sync_pattern.begin(), sync_pattern.end(), sector.begin());
+// Checks that the header behind a sync pattern decodes to a sector address
+// and a known mode, to reject sync patterns that occur inside damaged data
+bool is_plausible_sector(const sector_data &scrambled) {
+  const uint8_t *header = &scrambled[sync_pattern.size()];
+  uint8_t address[4];
+  for (size_t i = 0; i < sizeof(address); ++i) {
+    address[i] = header[i] ^ util::scramble_table[i];
+  }
+  const auto is_bcd = [](uint8_t n, uint8_t limit) {
+    return (n >> 4) < 10 && (n & 0x0f) < 10 && n < limit;
+  };
+  return is_bcd(address[0], 0xa0) && is_bcd(address[1], 0x60) &&
+         is_bcd(address[2], 0x75) &&
+         (address[3] == sector_mode_1 || address[3] == sector_mode_2);
+}
+
+constexpr size_t stream_search_block_size = 64 * 1024;
 
-    streamin_->read(reinterpret_cast<char *>(&sector[sync_pattern.size()]),
-                    sector.size() - sync_pattern.size());
+// Sectors read at a time from standard input; small enough that a damaged
+// sector found in the run is still within forward_stream_buffer's lookbehind
+constexpr size_t stdin_batch_size = 64;
 
-    address_byte_offset_ = static_cast<uint32_t>(streamin_->tellg());
-    address_byte_offset_ -= sector_size;
+} // namespace
 
-    sector_data sec_copy = sector;
-    unscramble_sector(sec_copy);
-    const sector_header &header = parse::get_sector_header(sec_copy);
-    address_block_offset_ =
-        util::sector_address_to_block(header.minutes, header.seconds,
-                                      header.sectors) -
-        150;
+const uint8_t *find_sync_pattern(const uint8_t *begin, const uint8_t *end) {
+  switch (cpu_simd_level()) {
+#ifdef CDI_HAS_X86_SIMD
+  case simd_level::avx2:
+    return find_sync_pattern_avx2(begin, end);
+  case simd_level::sse2:
+    return find_sync_pattern_sse2(begin, end);
+#endif
+  default:
+    return find_sync_pattern_scalar(begin, end);
+  }
+}
+
+sector_batch::sector_batch(size_t capacity)
+    : sectors_(std::max<size_t>(1, capacity)), headers_(sectors_.size()),
+      blocks_(sectors_.size()) {}
+
+disc_sequential_reader::disc_sequential_reader(std::string path,
+                                               reader_options options)
+    : path_(path), options_(options) {}
+
+disc_sequential_reader::~disc_sequential_reader() {
+  if (advice_fd_ >= 0) {
+    ::close(advice_fd_);
+  }
+}
+
+bool disc_sequential_reader::read_at(uint64_t pos,
+                                     const sector_data *&sector) {
+  if (mapping_) {
+    if (pos > mapping_->size() || mapping_->size() - pos < sector_size) {
+      return false;
+    }
+    sector = reinterpret_cast<const sector_data *>(mapping_->data() + pos);
+  } else {
+    if (pos != position_) {
+      streamin_->clear();
+      streamin_->seekg(pos);
+    }
+    streamin_->read(reinterpret_cast<char *>(&buffer_[0]), buffer_.size());
+    if (streamin_->fail()) {
+      return false;
+    }
+    sector = &buffer_;
+  }
+  position_ = pos + sector_size;
+  return true;
+}
+
+size_t disc_sequential_reader::read_run(uint64_t pos, sector_batch &batch,
+                                        size_t count) {
+  const size_t first = batch.size_;
+  size_t n = 0;
+  if (mapping_) {
+    const uint64_t available =
+        pos < mapping_->size() ? (mapping_->size() - pos) / sector_size : 0;
+    count = static_cast<size_t>(std::min<uint64_t>(count, available));
+    for (; n < count; ++n) {
+      const auto *sector = reinterpret_cast<const sector_data *>(
+          mapping_->data() + pos + n * sector_size);
+      if (!parse::is_valid_sector(*sector)) {
+        break;
+      }
+      batch.sectors_[first + n] = sector;
+    }
   } else {
-    streamin_->read(reinterpret_cast<char *>(&sector[0]), sector.size());
+    if (batch.buffer_.size() < batch.capacity()) {
+      batch.buffer_.resize(batch.capacity());
+    }
+    if (pos != position_) {
+      streamin_->clear();
+      streamin_->seekg(pos);
+    }
+    streamin_->read(reinterpret_cast<char *>(batch.buffer_[first].data()),
+                    count * sector_size);
+    const auto size = static_cast<size_t>(streamin_->gcount());
+    for (; n < size / sector_size; ++n) {
+      const sector_data &sector = batch.buffer_[first + n];
+      if (!parse::is_valid_sector(sector)) {
+        break;
+      }
+      batch.sectors_[first + n] = &sector;
+    }
+    if (n * sector_size != size) {
+      // leave the stream at the sector that ended the run
+      streamin_->clear();
+      streamin_->seekg(pos + n * sector_size);
+    }
+  }
+  position_ = pos + n * sector_size;
+  num_fetched_ += static_cast<unsigned int>(n);
+  return n;
+}
+
+bool disc_sequential_reader::find_sector(uint64_t from, uint64_t &found) {
+  const sector_data *sector = nullptr;
+
+  if (mapping_) {
+    const uint8_t *begin = mapping_->data();
+    const uint8_t *end = begin + mapping_->size();
+    while (from < mapping_->size()) {
+      const uint8_t *match = find_sync_pattern(begin + from, end);
+      if (match == end) {
+        return false;
+      }
+      found = static_cast<uint64_t>(match - begin);
+      if (!read_at(found, sector)) {
+        return false;
+      }
+      if (is_plausible_sector(*sector)) {
+        return true;
+      }
+      from = found + 1;
+    }
+    return false;
+  }
+
+  std::vector<uint8_t> block(stream_search_block_size);
+  while (true) {
+    streamin_->clear();
+    streamin_->seekg(from);
+    streamin_->read(reinterpret_cast<char *>(block.data()), block.size());
+    const size_t size = static_cast<size_t>(streamin_->gcount());
+    position_ = from + size;
+    if (size < sync_pattern.size()) {
+      return false;
+    }
+
+    const uint8_t *match =
+        find_sync_pattern(block.data(), block.data() + size);
+    if (match == block.data() + size) {
+      if (size < block.size()) {
+        return false;
+      }
+      // keep the tail in case the pattern straddles two blocks
+      from += size - (sync_pattern.size() - 1);
+      continue;
+    }
+
+    found = from + static_cast<uint64_t>(match - block.data());
+    if (!read_at(found, sector)) {
+      return false;
+    }
+    if (is_plausible_sector(*sector)) {
+      return true;
+    }
+    from = found + 1;
+  }
+}
+
+void disc_sequential_reader::add_anchor(const sector_data &scrambled,
+                                        uint64_t pos) {
+  sector_data sec_copy;
+  unscramble_sector(scrambled, sec_copy);
+  const sector_header &header = parse::get_sector_header(sec_copy);
+  const uint32_t block = util::sector_address_to_block(
+                             header.minutes, header.seconds, header.sectors) -
+                         150;
+
+  const auto it = std::lower_bound(
+      anchors_.begin(), anchors_.end(), block,
+      [](const anchor &a, uint32_t b) { return a.block < b; });
+  if (it != anchors_.end() && it->block == block) {
+    return;
+  }
+  anchors_.insert(it, anchor{block, pos});
+}
+
+bool disc_sequential_reader::open() {
+  opened_ = true;
+
+  if (path_ == stdin_path) {
+    stdin_buffer_ = std::make_unique<forward_stream_buffer>(STDIN_FILENO);
+    streamin_ = std::make_unique<std::istream>(stdin_buffer_.get());
+  } else if (options_.use_mmap) {
+    mapping_ = mapped_file::open(path_, options_.huge_pages);
+  }
+  if (!mapping_ && !streamin_) {
+    streamin_ = std::make_unique<std::ifstream>(path_, std::ios_base::binary);
+    // std::ifstream does not expose its descriptor
+    advice_fd_ = ::open(path_.c_str(), O_RDONLY);
+  }
+
+  uint64_t pos = 0;
+  const sector_data *first = nullptr;
+  if (!find_sector(0, pos) || !read_at(pos, first)) {
+    return false;
+  }
+  add_anchor(*first, pos);
+
+  // rewind so the first fetch returns this sector
+  position_ = pos;
+  if (streamin_) {
+    streamin_->seekg(pos);
+  }
+  return true;
+}
+
+bool disc_sequential_reader::fetch_next_sector(const sector_data *&sector) {
+  if (done_) {
+    throw std::runtime_error("done parsing");
+  }
+
+  if (!opened_ && !open()) {
+    close();
+    return false;
+  }
+
+  const uint64_t pos = position_;
+  if (read_at(pos, sector) && parse::is_valid_sector(*sector)) {
+    ++num_fetched_;
+    return true;
   }
 
-  if (streamin_->fail() ||
-      !std::equal(sync_pattern.begin(), sync_pattern.end(), sector.begin())) {
+  uint64_t found = 0;
+  if (!options_.resync || !find_sector(pos + 1, found) ||
+      !read_at(found, sector)) {
     close();
     return false;
   }
 
+  num_skipped_ += found - pos;
+  add_anchor(*sector, found);
+
   ++num_fetched_;
   return true;
 }
 
+bool disc_sequential_reader::fetch_next_sector(sector_data &sector) {
+  const sector_data *fetched = nullptr;
+  if (!fetch_next_sector(fetched)) {
+    return false;
+  }
+  sector = *fetched;
+  return true;
+}
+
+size_t disc_sequential_reader::fetch_sectors(sector_batch &batch) {
+  batch.size_ = 0;
+  if (done_) {
+    throw std::runtime_error("done parsing");
+  }
+
+  if (!opened_ && !open()) {
+    close();
+    return 0;
+  }
+
+  while (batch.size_ < batch.capacity()) {
+    size_t count = batch.capacity() - batch.size_;
+    if (stdin_buffer_) {
+      count = std::min(count, stdin_batch_size);
+    }
+    const size_t n = read_run(position_, batch, count);
+    batch.size_ += n;
+    if (n == count) {
+      continue;
+    }
+    if (batch.size_ > 0) {
+      // the next call takes the damaged sector or the end of the image
+      break;
+    }
+
+    // resync, or find that the image has ended
+    const sector_data *sector = nullptr;
+    if (!fetch_next_sector(sector)) {
+      return 0;
+    }
+    if (!mapping_) {
+      if (batch.buffer_.empty()) {
+        batch.buffer_.resize(batch.capacity());
+      }
+      batch.buffer_[0] = *sector;
+      sector = &batch.buffer_[0];
+    }
+    batch.sectors_[0] = sector;
+    batch.size_ = 1;
+  }
+
+  // the header is the first eight scrambled bytes of every sector, so each
+  // one unscrambles with the same eight table bytes
+  uint64_t key;
+  std::memcpy(&key, util::scramble_table.data(), sizeof(key));
+  for (size_t i = 0; i < batch.size_; ++i) {
+    uint64_t bytes;
+    std::memcpy(&bytes, &(*batch.sectors_[i])[sync_pattern.size()],
+                sizeof(bytes));
+    bytes ^= key;
+    sector_header &header = batch.headers_[i];
+    std::memcpy(&header, &bytes, sizeof(header));
+    batch.blocks_[i] = util::sector_address_to_block(
+                           header.minutes, header.seconds, header.sectors) -
+                       150;
+  }
+  return batch.size_;
+}
+
 void disc_sequential_reader::close() {
   done_ = true;
   streamin_.reset();
+  // the mapping stays until destruction so that views handed out remain valid
 }
 
 void disc_sequential_reader::seek(uint32_t block) {
-  const uint64_t seek_pos =
-      (block - address_block_offset_) * sector_size + address_byte_offset_;
-  streamin_->seekg(seek_pos);
+  if (!opened_ && !open()) {
+    close();
+    return;
+  }
+  if (done_) {
+    return;
+  }
+
+  const uint64_t seek_pos = block_offset(block);
+  if (streamin_) {
+    streamin_->clear();
+    streamin_->seekg(seek_pos);
+  }
+  position_ = seek_pos;
+}
+
+void disc_sequential_reader::read_ahead(uint32_t block, uint32_t count) {
+  if (!opened_ || done_) {
+    return;
+  }
+
+  const uint64_t offset = block_offset(block);
+  const uint64_t size = static_cast<uint64_t>(count) * sector_size;
+  if (mapping_) {
+    mapping_->will_need(static_cast<size_t>(offset),
+                        static_cast<size_t>(size));
+  } else if (advice_fd_ >= 0) {
+    posix_fadvise(advice_fd_, static_cast<off_t>(offset),
+                  static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+  }
+}
+
+uint64_t disc_sequential_reader::block_offset(uint32_t block) const {
+  // use the closest known position at or before the block
+  auto it = std::upper_bound(
+      anchors_.begin(), anchors_.end(), block,
+      [](uint32_t b, const anchor &a) { return b < a.block; });
+  if (it != anchors_.begin()) {
+    --it;
+  }
+
+  return it->byte_offset +
+         (static_cast<int64_t>(block) - static_cast<int64_t>(it->block)) *
+             static_cast<int64_t>(sector_size);
 }
 
 void disc_sequential_reader::unscramble_sector(sector_data &sector) const {
   assert(std::equal(sync_pattern.begin(), sync_pattern.end(), sector.begin()));
 
-  uint16_t lfsr = 1;
-  for (auto it = sector.begin() + sync_pattern.size(); it != sector.end();
-       ++it) {
-    uint16_t byte = *it;
-    for (unsigned i = 0; i < 8; ++i) {
-      byte ^= util::shift_lfsr(&lfsr) << i;
-    }
-    *it = static_cast<uint8_t>(byte);
+  xor_scramble_table(&sector[sync_pattern.size()],
+                     &sector[sync_pattern.size()]);
+}
+
+void disc_sequential_reader::unscramble_sector(const sector_data &scrambled,
+                                               sector_data &sector) const {
+  assert(
+      std::equal(sync_pattern.begin(), sync_pattern.end(), scrambled.begin()));
+
+  std::copy(sync_pattern.begin(), sync_pattern.end(), sector.begin());
+  xor_scramble_table(&scrambled[sync_pattern.size()],
+                     &sector[sync_pattern.size()]);
+}
+
+sector_header
+disc_sequential_reader::unscramble_header(const sector_data &scrambled) const {
+  assert(
+      std::equal(sync_pattern.begin(), sync_pattern.end(), scrambled.begin()));
+
+  uint8_t bytes[sizeof(sector_header)];
+  for (size_t i = 0; i < sizeof(bytes); ++i) {
+    bytes[i] = scrambled[sync_pattern.size() + i] ^ util::scramble_table[i];
   }
+  sector_header header;
+  std::memcpy(&header, bytes, sizeof(header));
+  return header;
 }
 
 } // namespace cd_i
@@ -13,6 +13,7 @@
 #include <iostream>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace cd_i {
 
@@ -21,6 +22,8 @@ constexpr size_t sector_size = 2352;
 constexpr std::array<uint8_t, 12> sync_pattern = {
     {0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00}};
 
+constexpr size_t scrambled_size = sector_size - sync_pattern.size();
+
 using sector_data = std::array<uint8_t, sector_size>;
 
 enum submode {
@@ -67,34 +70,158 @@ using mode2_data = std::array<uint8_t, mode2_data_size>;
 using mode2_form1_data = std::array<uint8_t, mode2_form1_data_size>;
 using mode2_form2_data = std::array<uint8_t, mode2_form2_data_size>;
 
+struct reader_options {
+  // map the image into memory instead of reading it through std::ifstream
+  bool use_mmap = true;
+  // ask the kernel to back the mapping with huge pages where supported
+  bool huge_pages = false;
+  // skip damaged regions by searching for the next valid sector instead of
+  // ending the read at the first sector without a sync pattern
+  bool resync = false;
+  // keep an index of sector headers and filesystem metadata next to the image
+  // and use it to skip sectors that are not needed
+  bool use_index = false;
+  // unscrambled sectors kept for disc_structure_reader::read_at
+  size_t sector_cache_size = 256;
+  // bytes the kernel is asked to read ahead of a forward sweep over files,
+  // 0 to leave it to its own read-ahead
+  size_t read_ahead = 8 << 20;
+  // sectors read at a time by a sector_batch made for these options
+  size_t batch_size = 256;
+};
+
+// Returns the first occurrence of sync_pattern in [begin, end), or end
+const uint8_t *find_sync_pattern(const uint8_t *begin, const uint8_t *end);
+
+// Image path that reads the image from standard input, e.g. from a pipe
+constexpr char stdin_path[] = "-";
+
+class mapped_file;
+class forward_stream_buffer;
+
+// Consecutive sectors fetched together by
+// disc_sequential_reader::fetch_sectors. Their headers are unscrambled into
+// one contiguous array so that they can be classified in bulk, e.g. with
+// sector_filter::match.
+class sector_batch {
+public:
+  explicit sector_batch(size_t capacity = reader_options().batch_size);
+
+  size_t size() const;
+  size_t capacity() const;
+  bool empty() const;
+
+  // The scrambled sector in slot i; stays valid until the next fetch into the
+  // batch, or for the lifetime of the reader if it has stable views
+  const sector_data &scrambled(size_t i) const;
+  const sector_header &header(size_t i) const;
+  const sector_header *headers() const;
+  // The block number the header of slot i gives
+  uint32_t block(size_t i) const;
+
+private:
+  friend class disc_sequential_reader;
+
+  // storage for sectors read from a stream
+  std::vector<sector_data> buffer_;
+  std::vector<const sector_data *> sectors_;
+  std::vector<sector_header> headers_;
+  std::vector<uint32_t> blocks_;
+  size_t size_ = 0;
+};
+
 class disc_sequential_reader {
 public:
-  disc_sequential_reader(std::string path);
+  disc_sequential_reader(std::string path, reader_options options = {});
+  ~disc_sequential_reader();
 
   bool fetch_next_sector(sector_data &sector);
+  // Zero-copy variant: the scrambled sector stays valid until the next fetch
+  // or seek
+  bool fetch_next_sector(const sector_data *&sector);
+  // Fills batch with as many of the following sectors as fit, reading runs of
+  // intact sectors with one read or straight from the mapping. Returns the
+  // number fetched, 0 where fetch_next_sector would have returned false.
+  size_t fetch_sectors(sector_batch &batch);
+  // True if fetched views stay valid for the lifetime of the reader
+  bool has_stable_views() const;
   unsigned int num_fetched_sectors() const;
+  // Bytes passed over while resyncing after damaged regions
+  uint64_t num_skipped_bytes() const;
 
   void seek(uint32_t block);
+  // Hints that count blocks from block are about to be read, so that the
+  // kernel can start reading them in the background
+  void read_ahead(uint32_t block, uint32_t count);
 
   void unscramble_sector(sector_data &sector) const;
+  void unscramble_sector(const sector_data &scrambled,
+                         sector_data &sector) const;
+  // Unscrambles only the header and subheader
+  sector_header unscramble_header(const sector_data &scrambled) const;
 
 private:
+  bool open();
   void close();
+  bool find_sector(uint64_t from, uint64_t &found);
+  bool read_at(uint64_t pos, const sector_data *&sector);
+  size_t read_run(uint64_t pos, sector_batch &batch, size_t count);
+  void add_anchor(const sector_data &scrambled, uint64_t pos);
+  uint64_t block_offset(uint32_t block) const;
 
 private:
+  // Image byte offset of a known block; damaged images get one per resync
+  struct anchor {
+    uint32_t block;
+    uint64_t byte_offset;
+  };
+
   std::string path_;
-  std::unique_ptr<std::ifstream> streamin_;
+  reader_options options_;
+  std::unique_ptr<forward_stream_buffer> stdin_buffer_;
+  std::unique_ptr<std::istream> streamin_;
+  std::unique_ptr<mapped_file> mapping_;
+  // descriptor of the image for read-ahead hints when it is not mapped
+  int advice_fd_ = -1;
+  uint64_t position_ = 0;
+  sector_data buffer_;
+  std::vector<anchor> anchors_;
+  bool opened_ = false;
   bool done_ = false;
   unsigned int num_fetched_ = 0;
-  uint32_t address_byte_offset_ = 0;
-  uint32_t address_block_offset_ = 0;
+  uint64_t num_skipped_ = 0;
 };
 
-inline disc_sequential_reader::disc_sequential_reader(std::string path)
-    : path_(path) {}
+inline size_t sector_batch::size() const { return size_; }
+
+inline size_t sector_batch::capacity() const { return sectors_.size(); }
+
+inline bool sector_batch::empty() const { return size_ == 0; }
+
+inline const sector_data &sector_batch::scrambled(size_t i) const {
+  return *sectors_[i];
+}
+
+inline const sector_header &sector_batch::header(size_t i) const {
+  return headers_[i];
+}
+
+inline const sector_header *sector_batch::headers() const {
+  return headers_.data();
+}
+
+inline uint32_t sector_batch::block(size_t i) const { return blocks_[i]; }
 
 inline unsigned int disc_sequential_reader::num_fetched_sectors() const {
   return num_fetched_;
 }
 
+inline bool disc_sequential_reader::has_stable_views() const {
+  return mapping_ != nullptr;
+}
+
+inline uint64_t disc_sequential_reader::num_skipped_bytes() const {
+  return num_skipped_;
+}
+
 } // namespace cd_i
@@ -0,0 +1,40 @@
+//
+//  sector_cache.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "sector_cache.h"
+
+#include <algorithm>
+
+namespace cd_i {
+
+sector_cache::sector_cache(size_t capacity)
+    : capacity_(std::max<size_t>(1, capacity)) {}
+
+const sector_data *sector_cache::find(uint32_t block) {
+  const auto found = blocks_.find(block);
+  if (found == blocks_.end()) {
+    return nullptr;
+  }
+  entries_.splice(entries_.begin(), entries_, found->second);
+  return &found->second->second;
+}
+
+sector_data &sector_cache::insert(uint32_t block) {
+  if (blocks_.size() < capacity_) {
+    entries_.emplace_front();
+  } else {
+    // reuse the least recently used sector
+    blocks_.erase(entries_.back().first);
+    entries_.splice(entries_.begin(), entries_, std::prev(entries_.end()));
+  }
+  entries_.front().first = block;
+  blocks_[block] = entries_.begin();
+  return entries_.front().second;
+}
+
+} // namespace cd_i
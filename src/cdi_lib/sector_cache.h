@@ -0,0 +1,39 @@
+//
+//  sector_cache.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "sector.h"
+
+#include <list>
+#include <unordered_map>
+
+namespace cd_i {
+
+// A fixed number of unscrambled sectors by block. When it is full, inserting
+// evicts the sector that was used least recently.
+class sector_cache {
+public:
+  explicit sector_cache(size_t capacity);
+
+  // Returns nullptr if the block is not cached; a hit makes it the most
+  // recently used
+  const sector_data *find(uint32_t block);
+  // Returns the slot to fill for a block that is not cached
+  sector_data &insert(uint32_t block);
+
+private:
+  using entry = std::pair<uint32_t, sector_data>;
+
+  size_t capacity_;
+  // most recently used first
+  std::list<entry> entries_;
+  std::unordered_map<uint32_t, std::list<entry>::iterator> blocks_;
+};
+
+} // namespace cd_i
@@ -0,0 +1,83 @@
+//
+//  sector_filter.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "sector_filter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CDI_HAS_X86_SIMD 1
+#endif
+
+namespace cd_i {
+
+namespace {
+
+#ifdef CDI_HAS_X86_SIMD
+
+// Four headers per step; a header matches if all eight of its bytes compare
+// equal after masking
+__attribute__((target("avx2"))) size_t
+match_avx2(const sector_header *headers, size_t count, uint64_t mask,
+           uint64_t value, uint8_t *matches) {
+  const __m256i masks = _mm256_set1_epi64x(static_cast<long long>(mask));
+  const __m256i values = _mm256_set1_epi64x(static_cast<long long>(value));
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(headers + i));
+    const uint32_t equal = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(bytes, masks), values)));
+    for (size_t j = 0; j < 4; ++j) {
+      matches[i + j] = ((equal >> (j * 8)) & 0xff) == 0xff;
+    }
+  }
+  return i;
+}
+
+__attribute__((target("sse2"))) size_t
+match_sse2(const sector_header *headers, size_t count, uint64_t mask,
+           uint64_t value, uint8_t *matches) {
+  const __m128i masks = _mm_set1_epi64x(static_cast<long long>(mask));
+  const __m128i values = _mm_set1_epi64x(static_cast<long long>(value));
+  size_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(headers + i));
+    const uint32_t equal = static_cast<uint32_t>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(bytes, masks), values)));
+    matches[i] = (equal & 0xff) == 0xff;
+    matches[i + 1] = (equal >> 8) == 0xff;
+  }
+  return i;
+}
+
+#endif
+
+} // namespace
+
+void sector_filter::match(const sector_header *headers, size_t count,
+                          uint8_t *matches) const {
+  size_t i = 0;
+#ifdef CDI_HAS_X86_SIMD
+  static const bool has_avx2 = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+  }();
+  static const bool has_sse2 = __builtin_cpu_supports("sse2") != 0;
+  if (has_avx2) {
+    i = match_avx2(headers, count, mask_, value_, matches);
+  } else if (has_sse2) {
+    i = match_sse2(headers, count, mask_, value_, matches);
+  }
+#endif
+  for (; i < count; ++i) {
+    matches[i] = (*this)(headers[i]);
+  }
+}
+
+} // namespace cd_i
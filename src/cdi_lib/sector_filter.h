@@ -0,0 +1,115 @@
+//
+//  sector_filter.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "media.h"
+#include "sector.h"
+
+#include <cstddef>
+#include <cstring>
+
+namespace cd_i {
+
+// Matches sector headers against constraints on their fields. However many
+// constraints are combined, matching is a single mask-and-compare of the
+// eight header bytes loaded as one integer.
+class sector_filter {
+public:
+  // Matches every header
+  constexpr sector_filter() = default;
+
+  constexpr sector_filter mode(uint8_t mode) const {
+    return constrain(offsetof(sector_header, mode), 0xff, mode);
+  }
+  constexpr sector_filter file(uint8_t file_num) const {
+    return constrain(offsetof(sector_header, file_num), 0xff, file_num);
+  }
+  constexpr sector_filter channel(uint8_t channel_num) const {
+    return constrain(offsetof(sector_header, channel_num), 0xff, channel_num);
+  }
+  // The submode bits set in mask must be as they are in bits
+  constexpr sector_filter submode(uint8_t mask, uint8_t bits) const {
+    return constrain(offsetof(sector_header, submode), mask, bits);
+  }
+  // The coding bits set in mask must be as they are in bits
+  constexpr sector_filter coding(uint8_t mask, uint8_t bits) const {
+    return constrain(offsetof(sector_header, coding_info), mask, bits);
+  }
+
+  bool operator()(const sector_header &header) const {
+    uint64_t bytes;
+    std::memcpy(&bytes, &header, sizeof(bytes));
+    return (bytes & mask_) == value_;
+  }
+  bool operator()(const sector_data &sector) const {
+    uint64_t bytes;
+    std::memcpy(&bytes, &sector[sync_pattern.size()], sizeof(bytes));
+    return (bytes & mask_) == value_;
+  }
+
+  // Sets matches[i] to 1 if headers[i] matches and to 0 otherwise
+  void match(const sector_header *headers, size_t count,
+             uint8_t *matches) const;
+
+private:
+  static_assert(sizeof(sector_header) == sizeof(uint64_t), "");
+  // the byte at offset lands in bits offset * 8 and up, as on the x86 and ARM
+  // hosts the rest of the code assumes
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "");
+
+  constexpr sector_filter constrain(size_t offset, uint8_t mask,
+                                    uint8_t bits) const {
+    const unsigned shift = static_cast<unsigned>(offset * 8);
+    const uint64_t field_mask = static_cast<uint64_t>(mask) << shift;
+    const uint64_t field_value = static_cast<uint64_t>(bits & mask) << shift;
+
+    sector_filter filter = *this;
+    const uint64_t overlap = mask_ & field_mask;
+    if ((value_ & overlap) != (field_value & overlap)) {
+      // contradicts an earlier constraint, so nothing can match
+      filter.mask_ = 0;
+      filter.value_ = 1;
+      return filter;
+    }
+    filter.mask_ |= field_mask;
+    filter.value_ |= field_value;
+    return filter;
+  }
+
+  uint64_t mask_ = 0;
+  uint64_t value_ = 0;
+};
+
+// Filters for the kinds of sectors the extractors look for
+namespace filters {
+
+constexpr sector_filter mode2 = sector_filter().mode(sector_mode_2);
+constexpr sector_filter form1 = mode2.submode(submode::form, 0);
+constexpr sector_filter form2 = mode2.submode(submode::form, submode::form);
+
+constexpr sector_filter video = mode2.submode(submode::video, submode::video);
+constexpr sector_filter mpeg_video = video.coding(0xff, video_coding_MPEG);
+constexpr sector_filter dyuv = video.coding(coding_mask, coding_DYUV);
+// both planes; the lower and upper coding differ only in the lowest bit
+constexpr sector_filter rgb555 =
+    video.coding(coding_mask & ~1, coding_RGB555_lower);
+
+constexpr sector_filter audio = mode2.submode(submode::audio, submode::audio);
+constexpr sector_filter mpeg_audio = audio.coding(0xff, audio_coding_MPEG);
+
+constexpr sector_filter message = form2.file(0).channel(0).coding(0xff, 0);
+constexpr sector_filter empty =
+    mode2.channel(0)
+        .submode(submode::video | submode::audio | submode::data, 0)
+        .coding(0xff, 0);
+constexpr sector_filter eof = mode2.submode(submode::eof, submode::eof);
+
+} // namespace filters
+
+} // namespace cd_i
@@ -0,0 +1,259 @@
+//
+//  stream_buffer.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "stream_buffer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <unistd.h>
+
+namespace cd_i {
+
+namespace {
+
+constexpr size_t read_size = 256 * 1024;
+// enough to go back over a resync search block and the sector found in it
+constexpr size_t lookbehind_size = 256 * 1024;
+constexpr size_t max_window_size = 4 * read_size;
+
+} // namespace
+
+forward_stream_buffer::forward_stream_buffer(int fd) : fd_(fd) {
+  window_.reserve(max_window_size);
+  setg(window_.data(), window_.data(), window_.data());
+}
+
+forward_stream_buffer::~forward_stream_buffer() {
+  if (spill_) {
+    std::fclose(spill_);
+  }
+}
+
+uint64_t forward_stream_buffer::position() const {
+  return (replaying_ ? replay_start_ : window_start_) +
+         static_cast<uint64_t>(gptr() - eback());
+}
+
+uint64_t forward_stream_buffer::input_position() const {
+  return window_start_ + window_.size();
+}
+
+size_t forward_stream_buffer::read_input(char *data, size_t size) {
+  size_t total = 0;
+  while (total < size && !input_failed_) {
+    const ssize_t n = ::read(fd_, data + total, size - total);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      input_failed_ = true;
+      break;
+    }
+    total += static_cast<size_t>(n);
+  }
+  return total;
+}
+
+bool forward_stream_buffer::fill() {
+  const uint64_t pos = position();
+  if (window_.size() + read_size > max_window_size) {
+    const size_t ahead = static_cast<size_t>(input_position() - pos);
+    const size_t keep = std::min(window_.size(), lookbehind_size + ahead);
+    const size_t drop = window_.size() - keep;
+    spill_passed(window_start_ + drop);
+    window_.erase(window_.begin(), window_.begin() + drop);
+    window_start_ += drop;
+  }
+
+  const size_t old_size = window_.size();
+  window_.resize(old_size + read_size);
+  const size_t n = read_input(window_.data() + old_size, read_size);
+  window_.resize(old_size + n);
+  set_live(pos);
+  return n > 0;
+}
+
+void forward_stream_buffer::set_live(uint64_t pos) {
+  replaying_ = false;
+  setg(window_.data(), window_.data() + (pos - window_start_),
+       window_.data() + window_.size());
+}
+
+forward_stream_buffer::int_type forward_stream_buffer::underflow() {
+  if (gptr() < egptr()) {
+    return traits_type::to_int_type(*gptr());
+  }
+
+  const uint64_t pos = position();
+  if (replaying_) {
+    // a spilled range either continues in another one or in the window
+    if (!replay(pos)) {
+      if (pos < window_start_ || pos > input_position()) {
+        return traits_type::eof();
+      }
+      set_live(pos);
+    }
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+  }
+
+  if (!fill()) {
+    return traits_type::eof();
+  }
+  return traits_type::to_int_type(*gptr());
+}
+
+forward_stream_buffer::pos_type
+forward_stream_buffer::seekoff(off_type off, std::ios_base::seekdir dir,
+                               std::ios_base::openmode which) {
+  if (dir == std::ios_base::beg) {
+    return seekpos(pos_type(off), which);
+  }
+  if (dir == std::ios_base::cur) {
+    return seekpos(pos_type(static_cast<off_type>(position()) + off), which);
+  }
+  // the end of a pipe is not known until it is reached
+  return pos_type(off_type(-1));
+}
+
+forward_stream_buffer::pos_type
+forward_stream_buffer::seekpos(pos_type pos, std::ios_base::openmode which) {
+  if (!(which & std::ios_base::in) || off_type(pos) < 0) {
+    return pos_type(off_type(-1));
+  }
+  const auto target = static_cast<uint64_t>(off_type(pos));
+
+  // what lies between here and a target ahead may be wanted later
+  const uint64_t from = std::max(position(), window_start_);
+  if (target >= window_start_ && target <= input_position()) {
+    mark_passed(from, target);
+    set_live(target);
+    return pos;
+  }
+  if (target > input_position()) {
+    mark_passed(from, input_position());
+    if (!skip_to(target)) {
+      return pos_type(off_type(-1));
+    }
+    set_live(target);
+    return pos;
+  }
+  if (replay(target)) {
+    return pos;
+  }
+  return pos_type(off_type(-1));
+}
+
+bool forward_stream_buffer::skip_to(uint64_t pos) {
+  spill_passed(input_position());
+  window_start_ = input_position();
+  window_.clear();
+
+  std::vector<char> block(read_size);
+  while (window_start_ < pos) {
+    const size_t n = read_input(
+        block.data(),
+        static_cast<size_t>(std::min<uint64_t>(block.size(),
+                                               pos - window_start_)));
+    if (n == 0 || !spill(window_start_, block.data(), n)) {
+      return false;
+    }
+    window_start_ += n;
+  }
+  return true;
+}
+
+bool forward_stream_buffer::replay(uint64_t pos) {
+  auto it = spilled_.upper_bound(pos);
+  if (it == spilled_.begin()) {
+    return false;
+  }
+  --it;
+  const uint64_t offset_in_range = pos - it->first;
+  if (offset_in_range >= it->second.size) {
+    return false;
+  }
+
+  const size_t size = static_cast<size_t>(
+      std::min<uint64_t>(read_size, it->second.size - offset_in_range));
+  replay_.resize(size);
+  const off_t offset = static_cast<off_t>(it->second.offset + offset_in_range);
+  if (::pread(fileno(spill_), replay_.data(), size, offset) !=
+      static_cast<ssize_t>(size)) {
+    return false;
+  }
+  replay_start_ = pos;
+  replaying_ = true;
+  setg(replay_.data(), replay_.data(), replay_.data() + replay_.size());
+  return true;
+}
+
+void forward_stream_buffer::mark_passed(uint64_t begin, uint64_t end) {
+  if (begin >= end) {
+    return;
+  }
+  // merge with the ranges it touches
+  auto it = passed_.upper_bound(begin);
+  if (it != passed_.begin() && std::prev(it)->second >= begin) {
+    --it;
+  }
+  while (it != passed_.end() && it->first <= end) {
+    begin = std::min(begin, it->first);
+    end = std::max(end, it->second);
+    it = passed_.erase(it);
+  }
+  passed_.emplace(begin, end);
+}
+
+void forward_stream_buffer::spill_passed(uint64_t end) {
+  while (!passed_.empty() && passed_.begin()->first < end) {
+    const uint64_t begin = std::max(passed_.begin()->first, window_start_);
+    const uint64_t range_end = passed_.begin()->second;
+    const uint64_t spill_end = std::min(range_end, end);
+    if (begin < spill_end) {
+      spill(begin, window_.data() + (begin - window_start_),
+            static_cast<size_t>(spill_end - begin));
+    }
+    passed_.erase(passed_.begin());
+    if (range_end > end) {
+      passed_.emplace(end, range_end);
+    }
+  }
+}
+
+bool forward_stream_buffer::spill(uint64_t pos, const char *data,
+                                  size_t size) {
+  if (!spill_) {
+    spill_ = std::tmpfile();
+    if (!spill_) {
+      return false;
+    }
+  }
+  if (::pwrite(fileno(spill_), data, size, static_cast<off_t>(spill_size_)) !=
+      static_cast<ssize_t>(size)) {
+    return false;
+  }
+
+  // extend the previous range if this one continues it
+  auto it = spilled_.upper_bound(pos);
+  if (it != spilled_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->first + prev->second.size == pos &&
+        prev->second.offset + prev->second.size == spill_size_) {
+      prev->second.size += size;
+      spill_size_ += size;
+      return true;
+    }
+  }
+  spilled_.emplace(pos, spill_range{spill_size_, size});
+  spill_size_ += size;
+  return true;
+}
+
+} // namespace cd_i
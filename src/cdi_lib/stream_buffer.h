@@ -0,0 +1,80 @@
+//
+//  stream_buffer.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <streambuf>
+#include <vector>
+
+namespace cd_i {
+
+// Input buffer over a pipe or another descriptor that can only be read
+// forward. Seeking ahead reads past the bytes in between and sets them aside
+// in a temporary spill file, so that a later seek back to them is served from
+// there. Bytes that were read through the buffer are kept only for a short
+// distance behind the read position; seeking back further than that fails.
+class forward_stream_buffer : public std::streambuf {
+public:
+  explicit forward_stream_buffer(int fd);
+  ~forward_stream_buffer() override;
+
+  forward_stream_buffer(const forward_stream_buffer &) = delete;
+  forward_stream_buffer &operator=(const forward_stream_buffer &) = delete;
+
+  // Bytes set aside in the spill file so far
+  uint64_t spilled_bytes() const;
+
+protected:
+  int_type underflow() override;
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+                   std::ios_base::openmode which) override;
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override;
+
+private:
+  uint64_t position() const;
+  uint64_t input_position() const;
+  size_t read_input(char *data, size_t size);
+  bool fill();
+  bool skip_to(uint64_t pos);
+  bool replay(uint64_t pos);
+  void set_live(uint64_t pos);
+  void mark_passed(uint64_t begin, uint64_t end);
+  void spill_passed(uint64_t end);
+  bool spill(uint64_t pos, const char *data, size_t size);
+
+private:
+  struct spill_range {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  int fd_;
+  bool input_failed_ = false;
+  // the latest bytes read from fd_, starting at window_start_
+  std::vector<char> window_;
+  uint64_t window_start_ = 0;
+  // ranges of the window that a seek went past, to spill before they leave it
+  std::map<uint64_t, uint64_t> passed_;
+  std::FILE *spill_ = nullptr;
+  uint64_t spill_size_ = 0;
+  // spilled ranges by stream position
+  std::map<uint64_t, spill_range> spilled_;
+  // spilled bytes being read back
+  std::vector<char> replay_;
+  uint64_t replay_start_ = 0;
+  bool replaying_ = false;
+};
+
+inline uint64_t forward_stream_buffer::spilled_bytes() const {
+  return spill_size_;
+}
+
+} // namespace cd_i
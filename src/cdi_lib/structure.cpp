@@ -7,42 +7,92 @@
 //
 
 #include "structure.h"
+#include "file_sink.h"
+#include "index.h"
 #include "parse.h"
+#include "pipeline.h"
+#include "tree.h"
 #include "util.h"
 
 #include <algorithm>
 #include <boost/filesystem.hpp>
+#include <cstring>
+#include <exception>
 #include <filesystem>
 
 namespace cd_i {
 
-void disc_structure_reader::discard_sectors(
-    std::function<bool(const sector_data &)> predicate) {
-  read_sectors(predicate);
+namespace {
+
+const char *file_data(const sector_data &sector) {
+  return parse::is_mode2_form1_sector(sector)
+             ? parse::get_mode2_form1_data<char>(sector)
+             : parse::get_mode2_form2_data<char>(sector);
 }
 
-void disc_structure_reader::read_sectors(
-    std::function<bool(const sector_data &)> action,
-    bool consume_last /*= false*/) {
-  if (!has_current_sector_) {
-    if (!reader().fetch_next_sector(current_sector_)) {
-      has_current_sector_ = false;
-      throw std::runtime_error("error reading sector");
+// Keeps the kernel reading a window of blocks ahead of a forward sweep, so
+// that sectors are already in memory when the sweep gets to them
+class read_ahead_window {
+public:
+  read_ahead_window(disc_sequential_reader &reader, size_t bytes)
+      : reader_(reader), blocks_(static_cast<uint32_t>(bytes / sector_size)) {}
+
+  // Renews the hint once half the window has been read, or when the sweep
+  // jumps out of it
+  void advance(uint32_t block) {
+    if (blocks_ == 0 ||
+        (advised_ && block >= start_ && block - start_ < blocks_ / 2)) {
+      return;
     }
-    reader().unscramble_sector(current_sector_);
-    has_current_sector_ = true;
+    advised_ = true;
+    start_ = block;
+    reader_.read_ahead(block, blocks_);
   }
 
-  while (action(current_sector())) {
-    if (!reader().fetch_next_sector(current_sector_)) {
-      has_current_sector_ = false;
-      throw std::runtime_error("error reading sector");
-    }
-    reader().unscramble_sector(current_sector_);
+private:
+  disc_sequential_reader &reader_;
+  uint32_t blocks_;
+  bool advised_ = false;
+  uint32_t start_ = 0;
+};
+
+} // namespace
+
+disc_structure_reader::disc_structure_reader(std::string path,
+                                             reader_options options)
+    : path_(path), options_(options), reader_(path, options),
+      sector_cache_(options.sector_cache_size) {
+  // the index lives next to an image file and is built by reading it again
+  if (path_ == stdin_path) {
+    options_.use_index = false;
   }
-  if (consume_last) {
+}
+
+disc_structure_reader::~disc_structure_reader() = default;
+
+void disc_structure_reader::discard_sectors(
+    std::function<bool(const sector_data &)> predicate) {
+  read_sectors(predicate);
+}
+
+void disc_structure_reader::fetch_current_sector() {
+  fetch_current_header();
+  unscramble_current_sector();
+}
+
+sector_header disc_structure_reader::fetch_current_header() {
+  if (!reader().fetch_next_sector(scrambled_)) {
     has_current_sector_ = false;
+    throw std::runtime_error("error reading sector");
   }
+  const sector_header header = reader().unscramble_header(*scrambled_);
+  check_indexed_header(sector_block(header), header);
+  return header;
+}
+
+void disc_structure_reader::unscramble_current_sector() {
+  // current_sector_ doubles as the scratch buffer sectors are unscrambled into
+  reader().unscramble_sector(*scrambled_, current_sector_);
 }
 
 void disc_structure_reader::init_reader() {
@@ -51,11 +101,32 @@ void disc_structure_reader::init_reader() {
   }
 
   try {
-    discard_sectors([](const sector_data &sector) {
-      return parse::is_message_sector(sector);
-    });
-    read_disc_labels();
-    read_path_table();
+    if (options_.use_index) {
+      auto index = std::make_unique<sector_index>();
+      try {
+        if (index->load(path_)) {
+          disc_labels_ = index->disc_labels();
+          parse_path_table(index->path_table());
+          index_ = std::move(index);
+        }
+      } catch (std::exception &) {
+        // a damaged index is treated as a missing one and rebuilt below
+        disc_labels_.clear();
+        path_table_.clear();
+      }
+    }
+
+    if (!index_) {
+      discard_sectors([](const sector_data &sector) {
+        return parse::is_message_sector(sector);
+      });
+      read_disc_labels();
+      read_path_table();
+      if (options_.use_index) {
+        build_index();
+      }
+    }
+    build_tree();
   } catch (std::exception &ex) {
     failed_ = false;
     throw;
@@ -95,6 +166,10 @@ void disc_structure_reader::read_path_table() {
       util::swap_byte_order(first_disc_label().path_table_address);
   reader().seek(address);
 
+  parse_path_table(read_extent_data());
+}
+
+std::vector<mode2_form1_data> disc_structure_reader::read_extent_data() {
   std::vector<mode2_form1_data> raw_data;
   read_sectors(
       [&raw_data](const sector_data &sector) {
@@ -103,7 +178,110 @@ void disc_structure_reader::read_path_table() {
         return !parse::is_eof_sector(sector);
       },
       true);
-  parse_path_table(raw_data);
+  return raw_data;
+}
+
+void disc_structure_reader::build_index() {
+  auto index = std::make_unique<sector_index>();
+  if (!index->scan_image(path_, options_)) {
+    return;
+  }
+
+  index->set_disc_labels(disc_labels_);
+
+  reader().seek(util::swap_byte_order(first_disc_label().path_table_address));
+  has_current_sector_ = false;
+  index->set_path_table(read_extent_data());
+
+  for (const auto &pair : path_table_) {
+    seek(pair.second);
+    index->add_directory(util::swap_byte_order(pair.second.directory_address),
+                         read_extent_data());
+  }
+
+  // an index that cannot be saved still helps this run
+  index->save(path_);
+  index_ = std::move(index);
+}
+
+std::vector<mode2_form1_data>
+disc_structure_reader::read_directory_data(const path_table_entry &entry) {
+  if (index_) {
+    const auto *raw_data =
+        index_->directory(util::swap_byte_order(entry.directory_address));
+    if (raw_data) {
+      return *raw_data;
+    }
+  }
+
+  seek(entry);
+  return read_extent_data();
+}
+
+void disc_structure_reader::build_tree() {
+  // read the directories in disc order so the reader only moves forward
+  std::vector<std::pair<uint32_t, const std::string *>> directories;
+  for (const auto &pair : path_table_) {
+    directories.emplace_back(
+        util::swap_byte_order(pair.second.directory_address), &pair.first);
+  }
+  std::sort(directories.begin(), directories.end());
+
+  auto tree = std::make_unique<directory_tree>();
+  std::vector<directory_tree::named_entry> entries;
+  for (const auto &directory : directories) {
+    entries.clear();
+    parse_directory(
+        read_directory_data(path_table_.at(*directory.second)),
+        [&entries](std::string name, const directory_entry &entry,
+                   const directory_entry_ex &entry_ex) {
+          entries.emplace_back(std::move(name),
+                               std::make_pair(entry, entry_ex));
+          return true;
+        });
+    tree->add_directory(*directory.second, entries);
+  }
+  tree_ = std::move(tree);
+}
+
+bool disc_structure_reader::plan_file_blocks(
+    const directory_entry &entry, const directory_entry_ex &entry_ex,
+    std::vector<uint32_t> &blocks) const {
+  const uint8_t file_num = entry_ex.file_number;
+  size_t remaining =
+      static_cast<size_t>(util::swap_byte_order(entry.file_size));
+
+  for (uint32_t block = util::swap_byte_order(entry.file_address);;
+       ++block) {
+    const sector_header *header = index_->header(block);
+    if (!header) {
+      return false;
+    }
+    if (file_num && header->file_num != file_num) {
+      continue;
+    }
+    if (parse::is_mode2_form1_sector(*header)) {
+      remaining -= std::min(remaining, mode2_form1_data_size);
+    } else if (parse::is_mode2_form2_sector(*header)) {
+      remaining -= std::min(remaining, mode2_form2_data_size);
+    } else {
+      // let the regular read report the corrupted sector
+      return false;
+    }
+    blocks.push_back(block);
+    if (remaining == 0) {
+      return true;
+    }
+  }
+}
+
+void disc_structure_reader::check_indexed_header(
+    uint32_t block, const sector_header &header) const {
+  if (index_ && !index_->matches(block, header)) {
+    throw index_mismatch_error("image does not match its index " +
+                               sector_index::sidecar_path(path_) +
+                               "; delete it to rebuild");
+  }
 }
 
 void disc_structure_reader::parse_path_table(
@@ -158,24 +336,27 @@ void disc_structure_reader::seek(const path_table_entry &entry) {
 
 bool disc_structure_reader::read_directory(std::string path,
                                            directory_entry_handler handler) {
+  if (tree_) {
+    const directory_tree::entry *begin;
+    const directory_tree::entry *end;
+    if (!tree_->directory(path, begin, end)) {
+      return false;
+    }
+    for (auto it = begin; it != end; ++it) {
+      if (!handler(std::string(tree_->name(*it)), it->record.first,
+                   it->record.second)) {
+        break;
+      }
+    }
+    return true;
+  }
+
   const auto found = path_table_.find(path);
   if (found == path_table_.end()) {
     return false;
   }
 
-  seek(found->second);
-
-  std::vector<mode2_form1_data> raw_data;
-
-  read_sectors(
-      [&raw_data](const sector_data &sector) {
-        raw_data.emplace_back();
-        parse::copy_mode2_form1_data(sector, raw_data.back());
-        return !parse::is_eof_sector(sector);
-      },
-      true);
-
-  parse_directory(raw_data, handler);
+  parse_directory(read_directory_data(found->second), handler);
   return true;
 }
 
@@ -243,71 +424,330 @@ void disc_structure_reader::parse_directory(
   }
 }
 
+file_sector_range
+disc_structure_reader::sectors(const directory_entry &entry,
+                               const directory_entry_ex &entry_ex,
+                               sector_predicate wanted /*= nullptr*/) {
+  return file_sector_range(*this, entry, entry_ex, std::move(wanted));
+}
+
 bool disc_structure_reader::read_file(const directory_entry &entry,
                                       const directory_entry_ex &entry_ex,
                                       file_handler handler) {
-  const uint8_t file_num = entry_ex.file_number;
-  size_t remaining =
-      static_cast<size_t>(util::swap_byte_order(entry.file_size));
-
-  seek(entry);
-  read_sectors([&](const sector_data &sector) {
-    if (file_num && parse::get_sector_header(sector).file_num != file_num) {
-      return true;
+  for (const auto &s : sectors(entry, entry_ex)) {
+    if (!handler(s.data, s.size)) {
+      break;
     }
-    if (parse::is_mode2_form1_sector(sector)) {
-      const size_t size = std::min(remaining, mode2_form1_data_size);
-      if (!handler(parse::get_mode2_form1_data<char>(sector), size)) {
-        return false;
-      }
-      remaining -= size;
-    } else if (parse::is_mode2_form2_sector(sector)) {
-      const size_t size = std::min(remaining, mode2_form2_data_size);
-      if (!handler(parse::get_mode2_form2_data<char>(sector), size)) {
-        return false;
-      }
-      remaining -= size;
-    } else {
-      throw std::runtime_error("corrupted data");
-    }
-    return remaining > 0;
-  });
+  }
   return true;
 }
 
 bool disc_structure_reader::scan_file(const directory_entry &entry,
                                       const directory_entry_ex &entry_ex,
-                                      scan_handler handler) {
+                                      scan_handler handler,
+                                      sector_predicate wanted /*= nullptr*/) {
+  for (const auto &s : sectors(entry, entry_ex, std::move(wanted))) {
+    if (!handler(*s.sector)) {
+      break;
+    }
+  }
+  return true;
+}
+
+disc_structure_reader::file_map &
+disc_structure_reader::map_file(const directory_entry &entry,
+                                const directory_entry_ex &entry_ex,
+                                uint64_t end) {
   const uint8_t file_num = entry_ex.file_number;
-  size_t remaining =
-      static_cast<size_t>(util::swap_byte_order(entry.file_size));
+  const uint32_t address = util::swap_byte_order(entry.file_address);
+  const uint64_t file_size = util::swap_byte_order(entry.file_size);
+  file_map &map = file_maps_[(static_cast<uint64_t>(address) << 8) | file_num];
+  if (map.blocks.empty()) {
+    map.next_block = address;
+  }
 
-  seek(entry);
-  read_sectors([&](const sector_data &sector) {
-    if (file_num && parse::get_sector_header(sector).file_num != file_num) {
-      return true;
+  // returns true if the sector belongs to the file
+  const auto add = [&](uint32_t block, const sector_header &header) {
+    map.next_block = block + 1;
+    if (file_num && header.file_num != file_num) {
+      return false;
     }
-    if (parse::is_mode2_form1_sector(sector)) {
-      const size_t size = std::min(remaining, mode2_form1_data_size);
-      remaining -= size;
-    } else if (parse::is_mode2_form2_sector(sector)) {
-      const size_t size = std::min(remaining, mode2_form2_data_size);
-      remaining -= size;
+    size_t size;
+    if (parse::is_mode2_form1_sector(header)) {
+      size = mode2_form1_data_size;
+    } else if (parse::is_mode2_form2_sector(header)) {
+      size = mode2_form2_data_size;
     } else {
       throw std::runtime_error("corrupted data");
     }
-    if (!handler(sector)) {
+    map.blocks.push_back(block);
+    map.offsets.push_back(map.size);
+    map.size = std::min(file_size, map.size + size);
+    return true;
+  };
+
+  end = std::min(end, file_size);
+  while (map.size < end) {
+    const sector_header *header =
+        index_ ? index_->header(map.next_block) : nullptr;
+    if (header) {
+      add(map.next_block, *header);
+      continue;
+    }
+
+    // the sectors have to be read anyway, so keep the ones in the file
+    reader().seek(map.next_block);
+    has_current_sector_ = false;
+    do {
+      const sector_header header = fetch_current_header();
+      const uint32_t block = sector_block(header);
+      if (add(block, header) && !sector_cache_.find(block)) {
+        unscramble_current_sector();
+        sector_cache_.insert(block) = current_sector();
+      }
+    } while (map.size < end);
+  }
+  return map;
+}
+
+const sector_data &disc_structure_reader::cached_sector(uint32_t block) {
+  const sector_data *cached = sector_cache_.find(block);
+  if (cached) {
+    return *cached;
+  }
+
+  reader().seek(block);
+  has_current_sector_ = false;
+  read_sectors([](const sector_data &) { return false; }, true);
+  sector_data &slot = sector_cache_.insert(block);
+  slot = current_sector();
+  return slot;
+}
+
+uint32_t disc_structure_reader::sector_block(const sector_header &header) {
+  return util::sector_address_to_block(header.minutes, header.seconds,
+                                       header.sectors) -
+         150;
+}
+
+uint32_t disc_structure_reader::sector_block(const sector_data &sector) {
+  return sector_block(parse::get_sector_header(sector));
+}
+
+void disc_structure_reader::scan_files(
+    const std::vector<directory_entry_2> &files, multi_scan_handler handler,
+    scan_done_handler done, sector_predicate wanted /*= nullptr*/) {
+  sweep_files(files, std::move(handler), std::move(done),
+              [&](const sector_batch &batch, uint8_t *matches) {
+                for (size_t i = 0; i < batch.size(); ++i) {
+                  matches[i] = !wanted || wanted(batch.header(i));
+                }
+              });
+}
+
+void disc_structure_reader::scan_files(
+    const std::vector<directory_entry_2> &files, multi_scan_handler handler,
+    scan_done_handler done, const sector_filter &wanted) {
+  sweep_files(files, std::move(handler), std::move(done),
+              [&](const sector_batch &batch, uint8_t *matches) {
+                wanted.match(batch.headers(), batch.size(), matches);
+              });
+}
+
+void disc_structure_reader::sweep_files(
+    const std::vector<directory_entry_2> &files, multi_scan_handler handler,
+    scan_done_handler done, batch_classifier classify) {
+  file_sweep sweep(files);
+  read_ahead_window window(reader(), options_.read_ahead);
+  sector_batch batch(options_.batch_size);
+  std::vector<uint8_t> matches(batch.capacity());
+  std::vector<file_sweep::delivery> deliveries;
+  std::vector<file_sweep::completion> completions;
+  // files whose handler asked to stop
+  std::vector<uint8_t> stopped(files.size(), 0);
+
+  const auto report = [&](const sector_data *sector) {
+    for (const auto &d : deliveries) {
+      if (!stopped[d.index] &&
+          !handler(d.index, *sector, file_data(*sector), d.size)) {
+        stopped[d.index] = 1;
+        done(d.index, true);
+      }
+    }
+    deliveries.clear();
+    for (const auto &c : completions) {
+      if (!stopped[c.index]) {
+        done(c.index, c.completed);
+      }
+    }
+    completions.clear();
+  };
+
+  try {
+    while (sweep.pending()) {
+      // nothing is in progress, so jump ahead to the next file
+      reader().seek(sweep.next_block());
+      has_current_sector_ = false;
+      bool reading = true;
+      while (reading) {
+        // the sectors of a batch past the end of the run are left unused
+        if (!reader().fetch_sectors(batch)) {
+          throw std::runtime_error("error reading sector");
+        }
+        classify(batch, matches.data());
+        for (size_t i = 0; i < batch.size() && reading; ++i) {
+          const uint32_t block = batch.block(i);
+          check_indexed_header(block, batch.header(i));
+          window.advance(block);
+          sweep.feed(block, batch.header(i), deliveries, completions);
+          if (!matches[i]) {
+            deliveries.clear();
+          }
+          // sectors no file wants are never unscrambled past the header
+          if (!deliveries.empty()) {
+            reader().unscramble_sector(batch.scrambled(i), current_sector_);
+          }
+          report(&current_sector_);
+          reading = sweep.wants_next(block);
+        }
+      }
+    }
+  } catch (std::exception &ex) {
+    // the disc ended or became unreadable before these files did
+    deliveries.clear();
+    sweep.abort(completions);
+    report(nullptr);
+    if (dynamic_cast<index_mismatch_error *>(&ex)) {
+      throw;
+    }
+  }
+}
+
+void disc_structure_reader::scan_files_parallel(
+    const std::vector<directory_entry_2> &files, multi_scan_handler handler,
+    scan_done_handler done, const pipeline_options &options) {
+  file_sweep sweep(files);
+  read_ahead_window window(reader(), options_.read_ahead);
+  sector_batch batch(options_.batch_size);
+  // the next sector of batch to hand out
+  size_t next = 0;
+  bool need_seek = true;
+  bool exhausted = false;
+  // set when the image turns out not to match its index
+  std::exception_ptr mismatch;
+  const unsigned int writers = std::max(1u, options.writers);
+  // files whose handler asked to stop, only touched by their writer
+  std::vector<uint8_t> stopped(files.size(), 0);
+
+  // I/O stage: needs only headers to know which files a sector belongs to
+  const auto produce = [&](pipeline_slot &slot) {
+    slot.source = nullptr;
+    slot.deliveries.clear();
+    slot.completions.clear();
+    if (exhausted) {
       return false;
     }
-    return remaining > 0;
-  });
-  return true;
+
+    try {
+      while (true) {
+        if (need_seek) {
+          if (!sweep.pending()) {
+            return false;
+          }
+          reader().seek(sweep.next_block());
+          need_seek = false;
+          // what is left of the batch is past the end of the run
+          next = batch.size();
+        }
+
+        if (next == batch.size()) {
+          if (!reader().fetch_sectors(batch)) {
+            throw std::runtime_error("error reading sector");
+          }
+          next = 0;
+        }
+        const size_t i = next++;
+        const uint32_t block = batch.block(i);
+        check_indexed_header(block, batch.header(i));
+        window.advance(block);
+        sweep.feed(block, batch.header(i), slot.deliveries, slot.completions);
+        need_seek = !sweep.wants_next(block);
+
+        if (!slot.deliveries.empty()) {
+          if (reader().has_stable_views()) {
+            slot.source = &batch.scrambled(i);
+          } else {
+            slot.sector = batch.scrambled(i);
+          }
+          return true;
+        }
+        // sectors no file wants are never descrambled
+        if (!slot.completions.empty()) {
+          return true;
+        }
+      }
+    } catch (std::exception &ex) {
+      // the disc ended or became unreadable before these files did
+      if (dynamic_cast<index_mismatch_error *>(&ex)) {
+        // finish the files first, then fail the scan
+        mismatch = std::current_exception();
+      }
+      exhausted = true;
+      slot.deliveries.clear();
+      sweep.abort(slot.completions);
+      return !slot.completions.empty();
+    }
+  };
+
+  const auto process = [this](pipeline_slot &slot) {
+    if (slot.deliveries.empty()) {
+      return;
+    }
+    if (slot.source) {
+      reader().unscramble_sector(*slot.source, slot.sector);
+    } else {
+      reader().unscramble_sector(slot.sector);
+    }
+  };
+
+  const auto consume = [&](const pipeline_slot &slot, unsigned int writer) {
+    for (const auto &d : slot.deliveries) {
+      if (d.index % writers != writer || stopped[d.index]) {
+        continue;
+      }
+      if (!handler(d.index, slot.sector, file_data(slot.sector), d.size)) {
+        stopped[d.index] = 1;
+        done(d.index, true);
+      }
+    }
+    for (const auto &c : slot.completions) {
+      if (c.index % writers == writer && !stopped[c.index]) {
+        done(c.index, c.completed);
+      }
+    }
+  };
+
+  has_current_sector_ = false;
+  run_pipeline(options, produce, process, consume);
+  if (mismatch) {
+    std::rethrow_exception(mismatch);
+  }
 }
 
 bool disc_structure_reader::stat_file(std::string directory_path,
                                       std::string filename,
                                       directory_entry &entry,
                                       directory_entry_ex &entry_ex) {
+  if (tree_) {
+    const auto *found = tree_->find(directory_path, filename);
+    if (!found) {
+      return false;
+    }
+    entry = found->record.first;
+    entry_ex = found->record.second;
+    return true;
+  }
+
   bool found = false;
   if (!read_directory(directory_path,
                       [&](std::string name, const directory_entry &found_entry,
@@ -336,19 +776,65 @@ bool disc_structure_reader::read_file(std::string directory_path,
   return read_file(entry, entry_ex, handler);
 }
 
+bool disc_structure_reader::read_at(const directory_entry &entry,
+                                    const directory_entry_ex &entry_ex,
+                                    uint64_t offset, char *data,
+                                    size_t &size) {
+  const file_map &map = map_file(entry, entry_ex, offset + size);
+  if (offset >= map.size) {
+    size = 0;
+    return true;
+  }
+  size = static_cast<size_t>(std::min<uint64_t>(size, map.size - offset));
+
+  // the sector holding offset
+  size_t i = static_cast<size_t>(
+      std::upper_bound(map.offsets.begin(), map.offsets.end(), offset) -
+      map.offsets.begin() - 1);
+  size_t copied = 0;
+  for (; copied < size; ++i) {
+    const uint64_t sector_end =
+        i + 1 < map.offsets.size() ? map.offsets[i + 1] : map.size;
+    const size_t skip = static_cast<size_t>(offset + copied - map.offsets[i]);
+    const size_t count = static_cast<size_t>(
+        std::min<uint64_t>(size - copied, sector_end - map.offsets[i] - skip));
+    std::memcpy(data + copied, file_data(cached_sector(map.blocks[i])) + skip,
+                count);
+    copied += count;
+  }
+  return true;
+}
+
+bool disc_structure_reader::read_at(std::string directory_path,
+                                    std::string filename, uint64_t offset,
+                                    char *data, size_t &size) {
+  directory_entry entry;
+  directory_entry_ex entry_ex;
+  if (!stat_file(directory_path, filename, entry, entry_ex)) {
+    return false;
+  }
+  return read_at(entry, entry_ex, offset, data, size);
+}
+
 bool disc_structure_reader::copy_file(const directory_entry &entry,
                                       const directory_entry_ex &entry_ex,
                                       std::string destination) {
   try {
-    std::ofstream stream_out(destination);
+    file_sink sink(destination, util::swap_byte_order(entry.file_size));
     if (!read_file(entry, entry_ex, [&](const char *data, size_t size) {
-          stream_out.write(data, size);
+          sink.write(data, size);
           return true;
         })) {
       throw std::runtime_error("file not found");
     }
+    if (!sink.close()) {
+      throw std::runtime_error("error writing file");
+    }
   } catch (std::exception &ex) {
     boost::filesystem::remove(destination);
+    if (dynamic_cast<index_mismatch_error *>(&ex)) {
+      throw;
+    }
     return false;
   }
   return true;
@@ -365,4 +851,71 @@ bool disc_structure_reader::copy_file(std::string directory_path,
   return copy_file(entry, entry_ex, destination);
 }
 
+file_sector_range::file_sector_range(
+    disc_structure_reader &reader, const directory_entry &entry,
+    const directory_entry_ex &entry_ex,
+    disc_structure_reader::sector_predicate wanted)
+    : reader_(reader), address_(util::swap_byte_order(entry.file_address)),
+      file_num_(entry_ex.file_number),
+      remaining_(static_cast<size_t>(util::swap_byte_order(entry.file_size))),
+      wanted_(std::move(wanted)) {
+  planned_ = reader_.index_ &&
+             reader_.plan_file_blocks(entry, entry_ex, blocks_);
+}
+
+bool file_sector_range::next() {
+  while (remaining_ > 0) {
+    uint32_t block;
+    if (planned_) {
+      // the plan already stops at the end of the file
+      if (next_block_ == blocks_.size()) {
+        return false;
+      }
+      block = blocks_[next_block_++];
+      // unwanted sectors are accounted for from their indexed headers alone
+      const sector_header &header = *reader_.index_->header(block);
+      if (wanted_ && !wanted_(header)) {
+        remaining_ -= std::min(remaining_, parse::is_mode2_form1_sector(header)
+                                               ? mode2_form1_data_size
+                                               : mode2_form2_data_size);
+        continue;
+      }
+    } else {
+      block = started_ ? last_read_ + 1 : address_;
+    }
+
+    if (!started_ || block != last_read_ + 1) {
+      reader_.reader().seek(block);
+    }
+    started_ = true;
+    last_read_ = block;
+    reader_.has_current_sector_ = false;
+
+    // skipped sectors are never unscrambled past the header
+    const sector_header header = reader_.fetch_current_header();
+    if (file_num_ && header.file_num != file_num_) {
+      continue;
+    }
+    const bool form1 = parse::is_mode2_form1_sector(header);
+    if (!form1 && !parse::is_mode2_form2_sector(header)) {
+      throw std::runtime_error("corrupted data");
+    }
+    const size_t size = std::min(
+        remaining_, form1 ? mode2_form1_data_size : mode2_form2_data_size);
+    remaining_ -= size;
+    if (wanted_ && !wanted_(header)) {
+      continue;
+    }
+
+    reader_.unscramble_current_sector();
+    const sector_data &sector = reader_.current_sector();
+    current_.sector = &sector;
+    current_.data = form1 ? parse::get_mode2_form1_data<char>(sector)
+                          : parse::get_mode2_form2_data<char>(sector);
+    current_.size = size;
+    return true;
+  }
+  return false;
+}
+
 } // namespace cd_i
@@ -9,8 +9,12 @@
 #pragma once
 
 #include "sector.h"
+#include "sector_cache.h"
+#include "sector_filter.h"
 
 #include <functional>
+#include <iterator>
+#include <memory>
 #include <unordered_map>
 #include <vector>
 
@@ -117,9 +121,22 @@ enum file_attr {
 
 using directory_entry_2 = std::pair<directory_entry, directory_entry_ex>;
 
+class directory_tree;
+class sector_index;
+class file_sector_range;
+struct pipeline_options;
+
+// One sector of a file and the file bytes it carries
+struct file_sector {
+  const sector_data *sector;
+  const char *data;
+  size_t size;
+};
+
 class disc_structure_reader {
 public:
-  disc_structure_reader(std::string path);
+  disc_structure_reader(std::string path, reader_options options = {});
+  ~disc_structure_reader();
 
   void init_reader();
 
@@ -128,6 +145,8 @@ public:
 
   const disc_label &first_disc_label() const;
 
+  uint64_t num_skipped_bytes() const;
+
   using directory_entry_handler = std::function<bool(
       std::string, const directory_entry &, const directory_entry_ex &)>;
 
@@ -146,51 +165,217 @@ public:
   bool read_file(std::string directory_path, std::string filename,
                  file_handler handler);
 
+  // Copies file contents starting at offset into data, like pread. On entry
+  // size is the number of bytes wanted, on return the number copied, which
+  // is less only at the end of the file. Sectors are cached, so reads close
+  // to each other do not go back to the image.
+  bool read_at(const directory_entry &entry, const directory_entry_ex &entry_ex,
+               uint64_t offset, char *data, size_t &size);
+  bool read_at(std::string directory_path, std::string filename,
+               uint64_t offset, char *data, size_t &size);
+
   bool copy_file(const directory_entry &entry,
                  const directory_entry_ex &entry_ex, std::string destination);
   bool copy_file(std::string directory_path, std::string filename,
                  std::string destination);
 
   using scan_handler = std::function<bool(const sector_data &)>;
-
+  using sector_predicate = std::function<bool(const sector_header &)>;
+
+  // The sectors of a file in disc order, read as the range is iterated.
+  // Sectors for which wanted returns false are skipped and, with an index,
+  // not read at all. The reader must not be used for anything else until the
+  // iteration is over.
+  file_sector_range sectors(const directory_entry &entry,
+                            const directory_entry_ex &entry_ex,
+                            sector_predicate wanted = nullptr);
+
+  // Sectors of the file for which wanted returns false are not passed to the
+  // handler and, with an index, not read at all
   bool scan_file(const directory_entry &entry,
-                 const directory_entry_ex &entry_ex, scan_handler handler);
+                 const directory_entry_ex &entry_ex, scan_handler handler,
+                 sector_predicate wanted = nullptr);
+
+  using multi_scan_handler = std::function<bool(
+      size_t, const sector_data &, const char *, size_t)>;
+  using scan_done_handler = std::function<void(size_t, bool)>;
+
+  // Reads all files in one forward pass in address order. The handler gets
+  // the index of the file each sector belongs to along with the file data the
+  // sector carries; done is called once per file, with false if the file
+  // could not be read to the end. Sectors for which wanted returns false are
+  // not passed to the handler.
+  void scan_files(const std::vector<directory_entry_2> &files,
+                  multi_scan_handler handler, scan_done_handler done,
+                  sector_predicate wanted = nullptr);
+  // Same, but each batch of sectors is classified in one sector_filter::match
+  void scan_files(const std::vector<directory_entry_2> &files,
+                  multi_scan_handler handler, scan_done_handler done,
+                  const sector_filter &wanted);
+  // Same as scan_files, but sectors are descrambled on worker threads and the
+  // handlers run on writer threads. All calls for one file come from the same
+  // writer thread, in order.
+  void scan_files_parallel(const std::vector<directory_entry_2> &files,
+                           multi_scan_handler handler, scan_done_handler done,
+                           const pipeline_options &options);
+
+  // Calls handler for each record of a directory extent until it returns
+  // false
+  static void parse_directory(const std::vector<mode2_form1_data> &raw_data,
+                              directory_entry_handler handler);
 
 protected:
   void seek(const directory_entry &entry);
   void seek(const directory_entry_2 &entry);
   void seek(const path_table_entry &entry);
-  void read_sectors(std::function<bool(const sector_data &)> action,
-                    bool consume_last = false);
+  // Calls action for each sector from the current position until it returns
+  // false. The sector it returned false for is read again by the next call
+  // unless consume_last is set.
+  template <typename Action>
+  void read_sectors(Action action, bool consume_last = false);
   void discard_sectors(std::function<bool(const sector_data &)> predicate);
 
 private:
+  friend class file_sector_range;
+
   disc_sequential_reader &reader();
+  void fetch_current_sector();
+  // Fetches the next sector but unscrambles only its header and subheader;
+  // the rest of current_sector_ is stale until unscramble_current_sector
+  sector_header fetch_current_header();
+  void unscramble_current_sector();
   void read_disc_labels();
   void read_path_table();
+  std::vector<mode2_form1_data> read_extent_data();
+  std::vector<mode2_form1_data>
+  read_directory_data(const path_table_entry &entry);
+  void build_index();
+  void build_tree();
+  bool plan_file_blocks(const directory_entry &entry,
+                        const directory_entry_ex &entry_ex,
+                        std::vector<uint32_t> &blocks) const;
+  // Throws if the index has a different header for a sector just read, which
+  // means the image changed since the index was saved
+  void check_indexed_header(uint32_t block, const sector_header &header) const;
   void parse_path_table(const std::vector<mode2_form1_data> &raw_data);
-  void parse_directory(const std::vector<mode2_form1_data> &raw_data,
-                       directory_entry_handler handler);
+
+  // Where each sector of a file starts within it, mapped as far as reads have
+  // needed so far
+  struct file_map {
+    std::vector<uint32_t> blocks;
+    std::vector<uint64_t> offsets;
+    uint32_t next_block = 0;
+    uint64_t size = 0;
+  };
+
+  // Sets matches[i] to whether the sweep wants sector i of the batch
+  using batch_classifier =
+      std::function<void(const sector_batch &, uint8_t *matches)>;
+
+  void sweep_files(const std::vector<directory_entry_2> &files,
+                   multi_scan_handler handler, scan_done_handler done,
+                   batch_classifier classify);
+
+  file_map &map_file(const directory_entry &entry,
+                     const directory_entry_ex &entry_ex, uint64_t end);
+  const sector_data &cached_sector(uint32_t block);
   const sector_data &current_sector() const;
+  static uint32_t sector_block(const sector_header &header);
+  static uint32_t sector_block(const sector_data &sector);
 
 private:
+  std::string path_;
+  reader_options options_;
   disc_sequential_reader reader_;
+  std::unique_ptr<sector_index> index_;
+  std::unique_ptr<directory_tree> tree_;
   bool inited_ = false;
   bool failed_ = false;
   bool has_current_sector_ = false;
   sector_data current_sector_;
+  // the fetched sector as read, valid until the next fetch or seek
+  const sector_data *scrambled_ = nullptr;
   std::vector<disc_label> disc_labels_;
   std::unordered_map<std::string, path_table_entry> path_table_;
+  // by file address and file number
+  std::unordered_map<uint64_t, file_map> file_maps_;
+  sector_cache sector_cache_;
 };
 
-inline disc_structure_reader::disc_structure_reader(std::string path)
-    : reader_(path) {}
+// Input range over the sectors of one file, see disc_structure_reader::sectors
+class file_sector_range {
+public:
+  class iterator {
+  public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = file_sector;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const file_sector *;
+    using reference = const file_sector &;
+
+    iterator() = default;
+    explicit iterator(file_sector_range *range) : range_(range) {}
+
+    reference operator*() const { return range_->current_; }
+    pointer operator->() const { return &range_->current_; }
+    iterator &operator++() {
+      if (!range_->next()) {
+        range_ = nullptr;
+      }
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return range_ == other.range_;
+    }
+    bool operator!=(const iterator &other) const {
+      return range_ != other.range_;
+    }
+
+  private:
+    file_sector_range *range_ = nullptr;
+  };
+
+  file_sector_range(const file_sector_range &) = delete;
+  file_sector_range &operator=(const file_sector_range &) = delete;
+
+  // Reads the first sector, so begin can only be called once
+  iterator begin() { return next() ? iterator(this) : iterator(); }
+  iterator end() { return iterator(); }
+
+private:
+  friend class disc_structure_reader;
+
+  file_sector_range(disc_structure_reader &reader,
+                    const directory_entry &entry,
+                    const directory_entry_ex &entry_ex,
+                    disc_structure_reader::sector_predicate wanted);
+
+  bool next();
+
+private:
+  disc_structure_reader &reader_;
+  uint32_t address_;
+  uint8_t file_num_;
+  size_t remaining_;
+  disc_structure_reader::sector_predicate wanted_;
+  // sectors of the file from the index, if it has them
+  bool planned_ = false;
+  std::vector<uint32_t> blocks_;
+  size_t next_block_ = 0;
+  bool started_ = false;
+  uint32_t last_read_ = 0;
+  file_sector current_{};
+};
 
 inline const std::unordered_map<std::string, path_table_entry> &
 disc_structure_reader::path_table() const {
   return path_table_;
 }
 
+inline uint64_t disc_structure_reader::num_skipped_bytes() const {
+  return reader_.num_skipped_bytes();
+}
+
 inline disc_sequential_reader &disc_structure_reader::reader() {
   return reader_;
 }
@@ -207,4 +392,20 @@ inline void disc_structure_reader::seek(const directory_entry_2 &entry) {
   seek(entry.first);
 }
 
+template <typename Action>
+void disc_structure_reader::read_sectors(Action action,
+                                         bool consume_last /*= false*/) {
+  if (!has_current_sector_) {
+    fetch_current_sector();
+    has_current_sector_ = true;
+  }
+
+  while (action(current_sector())) {
+    fetch_current_sector();
+  }
+  if (consume_last) {
+    has_current_sector_ = false;
+  }
+}
+
 } // namespace cd_i
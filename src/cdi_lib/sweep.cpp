@@ -0,0 +1,77 @@
+//
+//  sweep.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "sweep.h"
+#include "parse.h"
+#include "util.h"
+
+#include <algorithm>
+#include <numeric>
+
+namespace cd_i {
+
+file_sweep::file_sweep(const std::vector<directory_entry_2> &files)
+    : files_(files), order_(files.size()) {
+  std::iota(order_.begin(), order_.end(), 0);
+  std::stable_sort(order_.begin(), order_.end(), [this](size_t a, size_t b) {
+    return start_block(a) < start_block(b);
+  });
+}
+
+uint32_t file_sweep::start_block(size_t index) const {
+  return util::swap_byte_order(files_[index].first.file_address);
+}
+
+void file_sweep::feed(uint32_t block, const sector_header &header,
+                      std::vector<delivery> &deliveries,
+                      std::vector<completion> &completions) {
+  while (next_ < order_.size() && start_block(order_[next_]) <= block) {
+    const directory_entry_2 &file = files_[order_[next_]];
+    active_.push_back({order_[next_], file.second.file_number,
+                       util::swap_byte_order(file.first.file_size)});
+    ++next_;
+  }
+
+  // returns true once the file is finished
+  const auto feed_file = [&](file_state &state) {
+    if (state.file_num && header.file_num != state.file_num) {
+      return false;
+    }
+    size_t size;
+    if (parse::is_mode2_form1_sector(header)) {
+      size = std::min(state.remaining, mode2_form1_data_size);
+    } else if (parse::is_mode2_form2_sector(header)) {
+      size = std::min(state.remaining, mode2_form2_data_size);
+    } else {
+      completions.push_back({state.index, false});
+      return true;
+    }
+    state.remaining -= size;
+    deliveries.push_back({state.index, size});
+    if (state.remaining == 0) {
+      completions.push_back({state.index, true});
+      return true;
+    }
+    return false;
+  };
+
+  active_.erase(std::remove_if(active_.begin(), active_.end(), feed_file),
+                active_.end());
+}
+
+void file_sweep::abort(std::vector<completion> &completions) {
+  for (const auto &state : active_) {
+    completions.push_back({state.index, false});
+  }
+  active_.clear();
+  for (; next_ < order_.size(); ++next_) {
+    completions.push_back({order_[next_], false});
+  }
+}
+
+} // namespace cd_i
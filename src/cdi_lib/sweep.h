@@ -0,0 +1,79 @@
+//
+//  sweep.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "structure.h"
+
+#include <vector>
+
+namespace cd_i {
+
+// Bookkeeping for reading a set of files in one forward pass: which files each
+// sector belongs to and where each file ends. It only needs sector headers, so
+// it can run ahead of descrambling.
+class file_sweep {
+public:
+  struct delivery {
+    size_t index;
+    // file data carried by the sector
+    size_t size;
+  };
+
+  struct completion {
+    size_t index;
+    // false if the file ran into a sector that is not mode 2
+    bool completed;
+  };
+
+  explicit file_sweep(const std::vector<directory_entry_2> &files);
+
+  // True while some files have not completed
+  bool pending() const;
+  // Block to continue reading from when no file is in progress
+  uint32_t next_block() const;
+
+  void feed(uint32_t block, const sector_header &header,
+            std::vector<delivery> &deliveries,
+            std::vector<completion> &completions);
+  // Whether the sector after block is needed, or reading should jump ahead
+  bool wants_next(uint32_t block) const;
+
+  // Fails every file that has not completed
+  void abort(std::vector<completion> &completions);
+
+private:
+  struct file_state {
+    size_t index;
+    uint8_t file_num;
+    size_t remaining;
+  };
+
+  uint32_t start_block(size_t index) const;
+
+private:
+  const std::vector<directory_entry_2> &files_;
+  std::vector<size_t> order_;
+  size_t next_ = 0;
+  std::vector<file_state> active_;
+};
+
+inline bool file_sweep::pending() const {
+  return next_ < order_.size() || !active_.empty();
+}
+
+inline uint32_t file_sweep::next_block() const {
+  return start_block(order_[next_]);
+}
+
+inline bool file_sweep::wants_next(uint32_t block) const {
+  return !active_.empty() ||
+         (next_ < order_.size() && start_block(order_[next_]) == block + 1);
+}
+
+} // namespace cd_i
@@ -0,0 +1,55 @@
+//
+//  tree.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "tree.h"
+
+namespace cd_i {
+
+uint32_t directory_tree::intern(const std::string &name) {
+  const auto found = name_offsets_.find(name);
+  if (found != name_offsets_.end()) {
+    return found->second;
+  }
+  const uint32_t offset = static_cast<uint32_t>(names_.size());
+  names_.append(name);
+  name_offsets_.emplace(name, offset);
+  return offset;
+}
+
+void directory_tree::add_directory(const std::string &path,
+                                   const std::vector<named_entry> &entries) {
+  const uint32_t begin = static_cast<uint32_t>(entries_.size());
+  for (const auto &named : entries) {
+    const uint32_t index = static_cast<uint32_t>(entries_.size());
+    entries_.push_back({named.second, intern(named.first),
+                        static_cast<uint32_t>(named.first.size())});
+    // the first of duplicate names wins, as with a directory map
+    paths_.emplace(path + "/" + named.first, index);
+  }
+  directories_[path] = {begin, static_cast<uint32_t>(entries_.size())};
+}
+
+bool directory_tree::directory(const std::string &path, const entry *&begin,
+                               const entry *&end) const {
+  const auto found = directories_.find(path);
+  if (found == directories_.end()) {
+    return false;
+  }
+  begin = entries_.data() + found->second.begin;
+  end = entries_.data() + found->second.end;
+  return true;
+}
+
+const directory_tree::entry *
+directory_tree::find(const std::string &directory_path,
+                     const std::string &name) const {
+  const auto found = paths_.find(directory_path + "/" + name);
+  return found != paths_.end() ? &entries_[found->second] : nullptr;
+}
+
+} // namespace cd_i
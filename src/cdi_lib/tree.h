@@ -0,0 +1,67 @@
+//
+//  tree.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 7/19/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "structure.h"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace cd_i {
+
+// Directory records of the whole disc, read once. The entries of each
+// directory are stored contiguously in one array in disc order, names are
+// interned into a single buffer and full paths ("<directory>/<name>") are
+// hashed to entry indices.
+class directory_tree {
+public:
+  struct entry {
+    directory_entry_2 record;
+    uint32_t name_offset;
+    uint32_t name_size;
+  };
+
+  using named_entry = std::pair<std::string, directory_entry_2>;
+
+  void add_directory(const std::string &path,
+                     const std::vector<named_entry> &entries);
+
+  // Entries of the directory; false if the directory is not in the tree
+  bool directory(const std::string &path, const entry *&begin,
+                 const entry *&end) const;
+  // Returns nullptr if there is no such entry
+  const entry *find(const std::string &directory_path,
+                    const std::string &name) const;
+
+  std::string_view name(const entry &e) const;
+
+private:
+  uint32_t intern(const std::string &name);
+
+private:
+  struct range {
+    uint32_t begin;
+    uint32_t end;
+  };
+
+  std::vector<entry> entries_;
+  std::string names_;
+  std::unordered_map<std::string, uint32_t> name_offsets_;
+  std::unordered_map<std::string, range> directories_;
+  std::unordered_map<std::string, uint32_t> paths_;
+};
+
+inline std::string_view directory_tree::name(const entry &e) const {
+  return std::string_view(names_).substr(e.name_offset, e.name_size);
+}
+
+} // namespace cd_i
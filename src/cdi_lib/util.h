@@ -19,9 +19,10 @@ inline uint8_t decode_address_component(uint8_t n) {
 
 inline uint32_t sector_address_to_block(uint8_t minutes, uint8_t seconds,
                                         uint8_t sectors) {
-  return ((decode_address_component(minutes) * 60) +
-          decode_address_component(seconds) * 75) +
-         sectors;
+  return (decode_address_component(minutes) * 60 +
+          decode_address_component(seconds)) *
+             75 +
+         decode_address_component(sectors);
 }
 
 inline uint32_t swap_byte_order(uint32_t n) {
@@ -29,7 +30,7 @@ inline uint32_t swap_byte_order(uint32_t n) {
          (n >> 24);
 }
 
-inline uint16_t shift_lfsr(uint16_t *lfsr) {
+constexpr uint16_t shift_lfsr(uint16_t *lfsr) {
   // taps: 15 14; feedback polynomial: x^15 + x^14 + 1
   const auto ret = *lfsr & 1;
   const auto bit = ((*lfsr >> 0) ^ (*lfsr >> 1)) & 1;
@@ -37,5 +38,21 @@ inline uint16_t shift_lfsr(uint16_t *lfsr) {
   return ret;
 }
 
+constexpr std::array<uint8_t, scrambled_size> make_scramble_table() {
+  std::array<uint8_t, scrambled_size> table{};
+  uint16_t lfsr = 1;
+  for (size_t n = 0; n < table.size(); ++n) {
+    uint8_t byte = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+      byte |= shift_lfsr(&lfsr) << i;
+    }
+    table[n] = byte;
+  }
+  return table;
+}
+
+// Keystream XORed over everything past the sync pattern
+inline constexpr auto scramble_table = make_scramble_table();
+
 } // namespace util
 } // namespace cd_i
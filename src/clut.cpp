@@ -0,0 +1,229 @@
+//
+//  clut.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "clut.h"
+#include "png_file.h"
+
+#include "cdi_lib/media.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+using namespace cd_i;
+
+namespace {
+
+// The two 4-bit indices of a byte, high nibble first
+constexpr std::array<std::array<uint8_t, 2>, 256> make_pair_table() {
+  std::array<std::array<uint8_t, 2>, 256> table{};
+  for (int byte = 0; byte < 256; ++byte) {
+    table[byte][0] = static_cast<uint8_t>(byte >> 4);
+    table[byte][1] = static_cast<uint8_t>(byte & 0x0f);
+  }
+  return table;
+}
+
+constexpr auto pair_table = make_pair_table();
+
+unsigned int index_bits(uint8_t coding_info) {
+  switch (coding_info & coding_mask) {
+  case coding_CLUT4:
+    return 4;
+  case coding_RL3:
+    return 3;
+  case coding_CLUT8:
+    return 8;
+  default:
+    return 7;
+  }
+}
+
+bool is_run_length_coding(uint8_t coding_info) {
+  const uint8_t coding = coding_info & coding_mask;
+  return coding == coding_RL3 || coding == coding_RL7;
+}
+
+// RL7: a byte with the top bit clear is one pixel; with the top bit set it is
+// followed by a run length, 0 meaning to the end of the line
+const uint8_t *decode_rl7_line(const uint8_t *current, const uint8_t *end,
+                               uint8_t *line, size_t width) {
+  size_t x = 0;
+  while (x < width && current < end) {
+    const uint8_t code = *current++;
+    if (!(code & 0x80)) {
+      line[x++] = code;
+      continue;
+    }
+    if (current == end) {
+      break;
+    }
+    const size_t count = *current++;
+    const size_t run = count ? std::min(count, width - x) : width - x;
+    std::memset(line + x, code & 0x7f, run);
+    x += run;
+  }
+  return current;
+}
+
+// RL3: each byte holds a pair of 3-bit indices; with the top bit set it is
+// followed by a count of pairs, 0 meaning to the end of the line
+const uint8_t *decode_rl3_line(const uint8_t *current, const uint8_t *end,
+                               uint8_t *line, size_t width) {
+  size_t x = 0;
+  while (x < width && current < end) {
+    const uint8_t code = *current++;
+    const auto &pair = pair_table[code & 0x77];
+    size_t pairs = 1;
+    if (code & 0x80) {
+      if (current == end) {
+        break;
+      }
+      const size_t count = *current++;
+      pairs = count ? count : (width - x + 1) / 2;
+    }
+    for (; pairs && x + 1 < width; --pairs, x += 2) {
+      std::memcpy(line + x, pair.data(), 2);
+    }
+    if (pairs && x < width) {
+      line[x++] = pair[0];
+    }
+  }
+  return current;
+}
+
+} // namespace
+
+bool is_clut_coding(uint8_t coding_info) {
+  switch (coding_info & coding_mask) {
+  case coding_CLUT4:
+  case coding_CLUT7:
+  case coding_CLUT8:
+  case coding_RL3:
+  case coding_RL7:
+    return true;
+  default:
+    return false;
+  }
+}
+
+const char *clut_coding_name(uint8_t coding_info) {
+  switch (coding_info & coding_mask) {
+  case coding_CLUT4:
+    return "clut4";
+  case coding_CLUT7:
+    return "clut7";
+  case coding_CLUT8:
+    return "clut8";
+  case coding_RL3:
+    return "rl3";
+  default:
+    return "rl7";
+  }
+}
+
+dyuv_size get_clut_frame_size(uint8_t coding_info, const dyuv_size &size) {
+  dyuv_size frame = size;
+  switch (coding_info & resolution_mask) {
+  case resolution_high:
+    frame.height *= 2;
+    frame.width *= 2;
+    break;
+  case resolution_double:
+    frame.width *= 2;
+    break;
+  }
+  return frame;
+}
+
+size_t get_clut_frame_bytes(uint8_t coding_info, const dyuv_size &size) {
+  if (is_run_length_coding(coding_info)) {
+    return 0;
+  }
+  const dyuv_size frame = get_clut_frame_size(coding_info, size);
+  const size_t pixels = frame.width * frame.height;
+  return (coding_info & coding_mask) == coding_CLUT4 ? (pixels + 1) / 2
+                                                      : pixels;
+}
+
+bool decode_clut(const std::vector<uint8_t> &data, uint8_t coding_info,
+                 const dyuv_size &size, std::vector<uint8_t> &indices) {
+  const dyuv_size frame = get_clut_frame_size(coding_info, size);
+  const size_t width = frame.width;
+  const size_t height = frame.height;
+  const size_t pixels = width * height;
+
+  indices.assign(pixels, 0);
+  const uint8_t *current = data.data();
+  const uint8_t *end = current + data.size();
+
+  switch (coding_info & coding_mask) {
+  case coding_CLUT8:
+    if (data.size() < pixels) {
+      return false;
+    }
+    std::copy(current, current + pixels, indices.begin());
+    break;
+
+  case coding_CLUT7:
+    if (data.size() < pixels) {
+      return false;
+    }
+    std::transform(current, current + pixels, indices.begin(),
+                   [](uint8_t byte) { return byte & 0x7f; });
+    break;
+
+  case coding_CLUT4:
+    if (data.size() < (pixels + 1) / 2) {
+      return false;
+    }
+    for (size_t i = 0; i + 1 < pixels; i += 2) {
+      std::memcpy(&indices[i], pair_table[*current++].data(), 2);
+    }
+    if (pixels & 1) {
+      indices[pixels - 1] = pair_table[*current][0];
+    }
+    break;
+
+  case coding_RL3:
+    for (size_t y = 0; y < height && current < end; ++y) {
+      current = decode_rl3_line(current, end, &indices[y * width], width);
+    }
+    break;
+
+  case coding_RL7:
+    for (size_t y = 0; y < height && current < end; ++y) {
+      current = decode_rl7_line(current, end, &indices[y * width], width);
+    }
+    break;
+
+  default:
+    return false;
+  }
+  return true;
+}
+
+bool convert_clut_png(const std::vector<uint8_t> &data, uint8_t coding_info,
+                      const dyuv_size &size, const std::string &destination) {
+  std::vector<uint8_t> indices;
+  if (!decode_clut(data, coding_info, size, indices)) {
+    return false;
+  }
+
+  const unsigned int bits = index_bits(coding_info);
+  const size_t colors = size_t(1) << bits;
+  png_palette palette(colors);
+  for (size_t i = 0; i < colors; ++i) {
+    const uint8_t gray = static_cast<uint8_t>(i * 255 / (colors - 1));
+    palette[i] = {gray, gray, gray};
+  }
+
+  const dyuv_size frame = get_clut_frame_size(coding_info, size);
+  return write_indexed_png_file(indices, frame.width, frame.height, palette,
+                                bits <= 4 ? 4 : 8, destination);
+}
@@ -0,0 +1,39 @@
+//
+//  clut.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "dyuv.h"
+
+#include <string>
+#include <vector>
+
+// Palette-based images: CLUT4/7/8 store one color index per pixel (two per
+// byte for CLUT4), RL3/RL7 run-length encode each line. The palette itself is
+// loaded by the application, so images are saved as indexed PNGs with a gray
+// ramp palette that can be replaced later.
+
+bool is_clut_coding(uint8_t coding_info);
+
+// File name prefix for the coding, e.g. "rl7"
+const char *clut_coding_name(uint8_t coding_info);
+
+// Frame dimensions, given the normal-resolution size
+dyuv_size get_clut_frame_size(uint8_t coding_info, const dyuv_size &size);
+
+// Bytes per frame for CLUT codings; 0 for run-length codings, whose frames
+// have no fixed size and end with a record
+size_t get_clut_frame_bytes(uint8_t coding_info, const dyuv_size &size);
+
+// Expands a frame into one palette index per pixel. Run-length data that ends
+// before the frame is complete leaves the rest at index 0.
+bool decode_clut(const std::vector<uint8_t> &data, uint8_t coding_info,
+                 const dyuv_size &size, std::vector<uint8_t> &indices);
+
+bool convert_clut_png(const std::vector<uint8_t> &data, uint8_t coding_info,
+                      const dyuv_size &size, const std::string &destination);
@@ -7,63 +7,32 @@
 //
 
 #include "dyuv.h"
-
-#include <png.h>
+#include "png_file.h"
 
 #include <algorithm>
 #include <array>
 #include <cassert>
 #include <cmath>
 
-static bool write_png_file(std::vector<uint8_t> &rgb_data, const size_t width,
-                           const size_t height, const std::string &path) {
-  FILE *file = fopen(path.c_str(), "wb");
-  if (!file) {
-    return false;
-  }
-
-  auto png_ptr =
-      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-  if (!png_ptr) {
-    return false;
-  }
-
-  auto info_ptr = png_create_info_struct(png_ptr);
-  if (!png_ptr) {
-    png_destroy_write_struct(&png_ptr, &info_ptr);
-    return false;
-  }
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DYUV_HAS_X86_SIMD 1
+#endif
 
-  png_set_IHDR(png_ptr, info_ptr, static_cast<png_uint_32>(width),
-               static_cast<png_uint_32>(height), 8, PNG_COLOR_TYPE_RGB,
-               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
-               PNG_FILTER_TYPE_DEFAULT);
+namespace {
 
-  auto row_pointers =
-      (uint8_t **)png_malloc(png_ptr, height * sizeof(uint8_t *));
-  for (int y = 0; y < height; y++) {
-    row_pointers[y] = &rgb_data[y * width * 3];
-  }
+constexpr std::array<uint8_t, 16> coding_table = {
+    {0, 1, 4, 9, 16, 27, 44, 79, 128, 177, 212, 229, 240, 247, 252, 255}};
 
-  png_init_io(png_ptr, file);
-  png_set_rows(png_ptr, info_ptr, row_pointers);
-  png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
-  png_free(png_ptr, row_pointers);
-  png_destroy_write_struct(&png_ptr, &info_ptr);
+} // namespace
 
-  fclose(file);
-  return true;
-}
-
-bool decode_dyuv(const std::vector<uint8_t> &dyuv_data,
-                 const dyuv_options &options, std::vector<uint8_t> &rgb_data) {
+bool decode_dyuv_scalar(const std::vector<uint8_t> &dyuv_data,
+                        const dyuv_options &options,
+                        std::vector<uint8_t> &rgb_data) {
   const size_t width = options.size.width;
   const size_t height = options.size.height;
   const size_t line_size = width;
 
-  constexpr std::array<uint8_t, 16> coding_table = {
-      {0, 1, 4, 9, 16, 27, 44, 79, 128, 177, 212, 229, 240, 247, 252, 255}};
-
   rgb_data.resize(width * height * 3);
   uint8_t *cur_out = &rgb_data[0];
 
@@ -135,6 +104,301 @@ bool decode_dyuv(const std::vector<uint8_t> &dyuv_data,
   return true;
 }
 
+#ifdef DYUV_HAS_X86_SIMD
+
+namespace {
+
+// Per row the SIMD kernels first build the Y, U and V values with byte-wise
+// prefix sums of the table-mapped deltas (every row restarts from the seed),
+// then convert to RGB several pixels at a time with the same fixed-point
+// arithmetic as the scalar decoder.
+
+// rows are padded to a whole number of the widest conversion step
+constexpr size_t dyuv_block = 32;
+
+struct dyuv_row_buffers {
+  explicit dyuv_row_buffers(size_t width)
+      : padded_width((width + dyuv_block - 1) / dyuv_block * dyuv_block),
+        in(padded_width), y(padded_width), uv(padded_width + 2),
+        u(padded_width), v(padded_width), rgbx(padded_width),
+        rgb(padded_width * 3 + dyuv_block) {}
+
+  size_t padded_width;
+  std::vector<uint8_t> in;
+  std::vector<uint8_t> y;
+  // u and v of each pixel pair, interleaved
+  std::vector<uint8_t> uv;
+  std::vector<uint8_t> u;
+  std::vector<uint8_t> v;
+  // one 32-bit word per pixel holding r, g and b in its low bytes
+  std::vector<uint32_t> rgbx;
+  std::vector<uint8_t> rgb;
+};
+
+__attribute__((target("sse4.1"))) void
+build_dyuv_row_yuv(const uint8_t *row, size_t width,
+                   const dyuv_options &options, dyuv_row_buffers &buf) {
+  std::copy(row, row + width, buf.in.begin());
+
+  const __m128i table = _mm_loadu_si128(
+      reinterpret_cast<const __m128i *>(coding_table.data()));
+  const __m128i low_nibble = _mm_set1_epi8(0x0f);
+  const __m128i last_byte = _mm_set1_epi8(15);
+  const __m128i last_pair = _mm_set1_epi16(0x0f0e);
+
+  __m128i carry_y = _mm_set1_epi8(static_cast<char>(options.seed.y));
+  __m128i carry_uv = _mm_set1_epi16(static_cast<short>(
+      options.seed.u | (static_cast<uint16_t>(options.seed.v) << 8)));
+
+  for (size_t i = 0; i < buf.padded_width; i += 16) {
+    const __m128i bytes =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.in[i]));
+
+    // Y: one delta per byte, prefix sum over all lanes
+    __m128i y = _mm_shuffle_epi8(table, _mm_and_si128(bytes, low_nibble));
+    y = _mm_add_epi8(y, _mm_slli_si128(y, 1));
+    y = _mm_add_epi8(y, _mm_slli_si128(y, 2));
+    y = _mm_add_epi8(y, _mm_slli_si128(y, 4));
+    y = _mm_add_epi8(y, _mm_slli_si128(y, 8));
+    y = _mm_add_epi8(y, carry_y);
+    carry_y = _mm_shuffle_epi8(y, last_byte);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&buf.y[i]), y);
+
+    // U in even and V in odd lanes, prefix sums with a stride of two lanes
+    __m128i uv = _mm_shuffle_epi8(
+        table, _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble));
+    uv = _mm_add_epi8(uv, _mm_slli_si128(uv, 2));
+    uv = _mm_add_epi8(uv, _mm_slli_si128(uv, 4));
+    uv = _mm_add_epi8(uv, _mm_slli_si128(uv, 8));
+    uv = _mm_add_epi8(uv, carry_uv);
+    carry_uv = _mm_shuffle_epi8(uv, last_pair);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&buf.uv[i]), uv);
+  }
+
+  // chroma of the odd pixel in each pair, averaged with the next pair;
+  // pavgb rounds up, so the low bit it carries in is taken off again to
+  // truncate like the scalar decoder
+  const __m128i low_bit = _mm_set1_epi8(1);
+  const __m128i low_byte = _mm_set1_epi16(0x00ff);
+  for (size_t i = 0; i < buf.padded_width; i += 16) {
+    const __m128i cur =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.uv[i]));
+    __m128i odd = cur;
+    if (options.interpolate) {
+      const __m128i next =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.uv[i + 2]));
+      odd = _mm_sub_epi8(_mm_avg_epu8(cur, next),
+                         _mm_and_si128(_mm_xor_si128(cur, next), low_bit));
+    }
+    // every 16-bit lane holds one pair, U in its low and V in its high byte
+    const __m128i u =
+        _mm_or_si128(_mm_and_si128(cur, low_byte), _mm_slli_epi16(odd, 8));
+    const __m128i v =
+        _mm_or_si128(_mm_srli_epi16(cur, 8), _mm_andnot_si128(low_byte, odd));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&buf.u[i]), u);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&buf.v[i]), v);
+  }
+
+  // the last pair has no next pair to interpolate with
+  if (width >= 2) {
+    buf.u[width - 1] = buf.u[width - 2];
+    buf.v[width - 1] = buf.v[width - 2];
+  }
+}
+
+__attribute__((target("ssse3"))) void
+store_dyuv_row_rgb(size_t width, dyuv_row_buffers &buf, uint8_t *out) {
+  // drop the fourth byte of every pixel
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                     -1, -1, -1, -1);
+  // each store writes 16 bytes for 12 bytes of pixels, so only steps that
+  // stay inside the row go straight to the output
+  size_t i = 0;
+  for (; i + 6 <= width; i += 4) {
+    const __m128i rgbx =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.rgbx[i]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 3),
+                     _mm_shuffle_epi8(rgbx, pack));
+  }
+  for (size_t j = i; j < width; j += 4) {
+    const __m128i rgbx =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.rgbx[j]));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(&buf.rgb[(j - i) * 3]),
+                     _mm_shuffle_epi8(rgbx, pack));
+  }
+  std::copy(buf.rgb.begin(), buf.rgb.begin() + (width - i) * 3, out + i * 3);
+}
+
+// The products below overflow 16 bits, so the arithmetic is done in 32-bit
+// lanes, 4 or 8 pixels per register. Each step loads 16 or 32 bytes of Y, U
+// and V at once and converts them as four groups.
+
+__attribute__((target("sse4.1"))) inline __m128i
+convert_dyuv_pixels_sse41(__m128i y, __m128i u, __m128i v) {
+  const __m128i c128 = _mm_set1_epi32(128);
+  const __m128i round = _mm_set1_epi32(0x7fff);
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i max = _mm_set1_epi32(0xffffff);
+
+  const __m128i y16 = _mm_slli_epi32(y, 16);
+  const __m128i b = _mm_add_epi32(
+      _mm_add_epi32(y16, _mm_mullo_epi32(_mm_sub_epi32(u, c128),
+                                         _mm_set1_epi32(113574))),
+      round);
+  const __m128i r = _mm_add_epi32(
+      _mm_add_epi32(y16, _mm_mullo_epi32(_mm_sub_epi32(v, c128),
+                                         _mm_set1_epi32(89850))),
+      round);
+  const __m128i g = _mm_add_epi32(
+      _mm_sub_epi32(
+          _mm_sub_epi32(
+              _mm_mullo_epi32(y, _mm_set1_epi32(111646)),
+              _mm_mullo_epi32(_mm_srai_epi32(r, 16), _mm_set1_epi32(33382))),
+          _mm_mullo_epi32(_mm_srai_epi32(b, 16), _mm_set1_epi32(12728))),
+      round);
+
+  const __m128i r8 =
+      _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(r, zero), max), 16);
+  const __m128i g8 =
+      _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(g, zero), max), 16);
+  const __m128i b8 =
+      _mm_srli_epi32(_mm_min_epi32(_mm_max_epi32(b, zero), max), 16);
+  return _mm_or_si128(
+      r8, _mm_or_si128(_mm_slli_epi32(g8, 8), _mm_slli_epi32(b8, 16)));
+}
+
+__attribute__((target("sse4.1"))) void
+convert_dyuv_row_sse41(size_t width, dyuv_row_buffers &buf) {
+  for (size_t i = 0; i < width; i += 16) {
+    const __m128i y =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.y[i]));
+    const __m128i u =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.u[i]));
+    const __m128i v =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.v[i]));
+    __m128i *out = reinterpret_cast<__m128i *>(&buf.rgbx[i]);
+
+    _mm_storeu_si128(out, convert_dyuv_pixels_sse41(_mm_cvtepu8_epi32(y),
+                                                    _mm_cvtepu8_epi32(u),
+                                                    _mm_cvtepu8_epi32(v)));
+    _mm_storeu_si128(out + 1, convert_dyuv_pixels_sse41(
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(y, 4)),
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(u, 4)),
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(v, 4))));
+    _mm_storeu_si128(out + 2, convert_dyuv_pixels_sse41(
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(y, 8)),
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(u, 8)),
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+    _mm_storeu_si128(out + 3, convert_dyuv_pixels_sse41(
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(y, 12)),
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(u, 12)),
+                                  _mm_cvtepu8_epi32(_mm_srli_si128(v, 12))));
+  }
+}
+
+__attribute__((target("avx2"))) inline __m256i
+convert_dyuv_pixels_avx2(__m256i y, __m256i u, __m256i v) {
+  const __m256i c128 = _mm256_set1_epi32(128);
+  const __m256i round = _mm256_set1_epi32(0x7fff);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i max = _mm256_set1_epi32(0xffffff);
+
+  const __m256i y16 = _mm256_slli_epi32(y, 16);
+  const __m256i b = _mm256_add_epi32(
+      _mm256_add_epi32(y16, _mm256_mullo_epi32(_mm256_sub_epi32(u, c128),
+                                               _mm256_set1_epi32(113574))),
+      round);
+  const __m256i r = _mm256_add_epi32(
+      _mm256_add_epi32(y16, _mm256_mullo_epi32(_mm256_sub_epi32(v, c128),
+                                               _mm256_set1_epi32(89850))),
+      round);
+  const __m256i g = _mm256_add_epi32(
+      _mm256_sub_epi32(
+          _mm256_sub_epi32(
+              _mm256_mullo_epi32(y, _mm256_set1_epi32(111646)),
+              _mm256_mullo_epi32(_mm256_srai_epi32(r, 16),
+                                 _mm256_set1_epi32(33382))),
+          _mm256_mullo_epi32(_mm256_srai_epi32(b, 16),
+                             _mm256_set1_epi32(12728))),
+      round);
+
+  const __m256i r8 = _mm256_srli_epi32(
+      _mm256_min_epi32(_mm256_max_epi32(r, zero), max), 16);
+  const __m256i g8 = _mm256_srli_epi32(
+      _mm256_min_epi32(_mm256_max_epi32(g, zero), max), 16);
+  const __m256i b8 = _mm256_srli_epi32(
+      _mm256_min_epi32(_mm256_max_epi32(b, zero), max), 16);
+  return _mm256_or_si256(
+      r8, _mm256_or_si256(_mm256_slli_epi32(g8, 8), _mm256_slli_epi32(b8, 16)));
+}
+
+__attribute__((target("avx2"))) void
+convert_dyuv_row_avx2(size_t width, dyuv_row_buffers &buf) {
+  for (size_t i = 0; i < width; i += 32) {
+    __m256i *out = reinterpret_cast<__m256i *>(&buf.rgbx[i]);
+    for (size_t half = 0; half < 2; ++half) {
+      const size_t j = i + half * 16;
+      const __m128i y =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.y[j]));
+      const __m128i u =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.u[j]));
+      const __m128i v =
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(&buf.v[j]));
+
+      _mm256_storeu_si256(out++,
+                          convert_dyuv_pixels_avx2(_mm256_cvtepu8_epi32(y),
+                                                   _mm256_cvtepu8_epi32(u),
+                                                   _mm256_cvtepu8_epi32(v)));
+      _mm256_storeu_si256(
+          out++, convert_dyuv_pixels_avx2(
+                     _mm256_cvtepu8_epi32(_mm_srli_si128(y, 8)),
+                     _mm256_cvtepu8_epi32(_mm_srli_si128(u, 8)),
+                     _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8))));
+    }
+  }
+}
+
+using dyuv_row_converter = void (*)(size_t, dyuv_row_buffers &);
+
+dyuv_row_converter select_dyuv_row_converter() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return &convert_dyuv_row_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return &convert_dyuv_row_sse41;
+  }
+  return nullptr;
+}
+
+} // namespace
+
+#endif
+
+bool decode_dyuv(const std::vector<uint8_t> &dyuv_data,
+                 const dyuv_options &options, std::vector<uint8_t> &rgb_data) {
+#ifdef DYUV_HAS_X86_SIMD
+  static const dyuv_row_converter convert_row = select_dyuv_row_converter();
+
+  const size_t width = options.size.width;
+  const size_t height = options.size.height;
+  if (!convert_row || width % 2 != 0) {
+    return decode_dyuv_scalar(dyuv_data, options, rgb_data);
+  }
+
+  rgb_data.resize(width * height * 3);
+  dyuv_row_buffers buf(width);
+  for (size_t row = 0; row < height; ++row) {
+    build_dyuv_row_yuv(&dyuv_data[row * width], width, options, buf);
+    convert_row(width, buf);
+    store_dyuv_row_rgb(width, buf, &rgb_data[row * width * 3]);
+  }
+  return true;
+#else
+  return decode_dyuv_scalar(dyuv_data, options, rgb_data);
+#endif
+}
+
 bool convert_dyuv_png(const std::vector<uint8_t> &dyuv_data,
                       const dyuv_options &options,
                       const std::string &destination) {
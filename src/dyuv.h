@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <array>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,9 @@ struct dyuv_size {
   size_t height = 280;
 };
 
+constexpr std::array<dyuv_size, 3> supported_dyuv_sizes = {
+    {{384, 280}, {384, 240}, {360, 240}}};
+
 struct dyuv_seed {
   uint8_t y = 16;
   uint8_t u = 128;
@@ -28,9 +32,15 @@ struct dyuv_options {
   bool interpolate = true;
 };
 
+// Uses a SIMD kernel when the CPU supports one, output is identical to
+// decode_dyuv_scalar
 bool decode_dyuv(const std::vector<uint8_t> &dyuv_data,
                  const dyuv_options &options, std::vector<uint8_t> &rgb_data);
 
+bool decode_dyuv_scalar(const std::vector<uint8_t> &dyuv_data,
+                        const dyuv_options &options,
+                        std::vector<uint8_t> &rgb_data);
+
 bool convert_dyuv_png(const std::vector<uint8_t> &dyuv_data,
                       const dyuv_options &options,
                       const std::string &destination);
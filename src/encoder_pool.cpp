@@ -0,0 +1,83 @@
+//
+//  encoder_pool.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "encoder_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+dyuv_encoder_pool::dyuv_encoder_pool(unsigned int threads,
+                                     size_t max_in_flight /*= 0*/) {
+  threads = std::max(1u, threads);
+  // enough to keep every thread busy while the reader assembles the next frame
+  max_in_flight_ = max_in_flight ? max_in_flight : threads * 2;
+  for (unsigned int i = 0; i < threads; ++i) {
+    threads_.emplace_back([this] { run(); });
+  }
+}
+
+dyuv_encoder_pool::~dyuv_encoder_pool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+void dyuv_encoder_pool::submit(std::vector<uint8_t> dyuv_data,
+                               const dyuv_options &options,
+                               std::string destination) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  room_available_.wait(lock, [this] { return in_flight_ < max_in_flight_; });
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+  queue_.push_back({std::move(dyuv_data), options, std::move(destination)});
+  ++in_flight_;
+  lock.unlock();
+  work_available_.notify_one();
+}
+
+void dyuv_encoder_pool::wait() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  room_available_.wait(lock, [this] { return in_flight_ == 0; });
+  if (error_) {
+    std::rethrow_exception(std::exchange(error_, nullptr));
+  }
+}
+
+void dyuv_encoder_pool::run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    work_available_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      return;
+    }
+
+    frame job = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+
+    std::exception_ptr error;
+    try {
+      convert_dyuv_png(job.dyuv_data, job.options, job.destination);
+    } catch (...) {
+      error = std::current_exception();
+    }
+
+    lock.lock();
+    if (error && !error_) {
+      error_ = error;
+    }
+    --in_flight_;
+    room_available_.notify_all();
+  }
+}
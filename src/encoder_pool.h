@@ -0,0 +1,57 @@
+//
+//  encoder_pool.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include "dyuv.h"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Decodes DYUV frames and encodes them as PNG on background threads. At most
+// max_in_flight frames are queued or being encoded; submit blocks until there
+// is room, which keeps memory bounded when reading outpaces compression.
+class dyuv_encoder_pool {
+public:
+  dyuv_encoder_pool(unsigned int threads, size_t max_in_flight = 0);
+  ~dyuv_encoder_pool();
+
+  dyuv_encoder_pool(const dyuv_encoder_pool &) = delete;
+  dyuv_encoder_pool &operator=(const dyuv_encoder_pool &) = delete;
+
+  void submit(std::vector<uint8_t> dyuv_data, const dyuv_options &options,
+              std::string destination);
+
+  // Waits for all submitted frames; rethrows the first encoding error
+  void wait();
+
+private:
+  struct frame {
+    std::vector<uint8_t> dyuv_data;
+    dyuv_options options;
+    std::string destination;
+  };
+
+  void run();
+
+private:
+  size_t max_in_flight_;
+  std::vector<std::thread> threads_;
+  std::mutex mutex_;
+  std::condition_variable work_available_;
+  std::condition_variable room_available_;
+  std::deque<frame> queue_;
+  size_t in_flight_ = 0;
+  bool stopping_ = false;
+  std::exception_ptr error_;
+};
@@ -9,7 +9,13 @@
 #include "helper.h"
 
 #include "cdi_lib/debug.h"
+#include "cdi_lib/pipeline.h"
+#include "cdi_lib/util.h"
+#include "clut.h"
 #include "dyuv.h"
+#include "encoder_pool.h"
+#include "png_file.h"
+#include "rgb555.h"
 
 #include <boost/format.hpp>
 
@@ -28,6 +34,13 @@ void cdi_helper::read_disc_paths() {
   paths_ = reader_.copy_all_paths();
 }
 
+void cdi_helper::report_skipped_data() const {
+  const uint64_t skipped = reader_.num_skipped_bytes();
+  if (skipped) {
+    std::cerr << "Skipped " << skipped << " bytes of damaged data" << std::endl;
+  }
+}
+
 void cdi_helper::print_directory(const std::string &path) {
   reader_.read_directory(path, [](std::string name, const directory_entry &,
                                   const directory_entry_ex &) {
@@ -68,127 +81,527 @@ void cdi_helper::enum_directory(
     std::function<void(const std::string &, const directory_entry &,
                        const directory_entry_ex &)>
         action) {
-  std::unordered_map<std::string, directory_entry_2> files;
-  reader_.read_directory(path, files);
-
-  for (const auto &pair : files) {
-    const std::string &name = pair.first;
-    const directory_entry &file = pair.second.first;
-    const directory_entry_ex &file_ex = pair.second.second;
-    if (parse::is_directory(file_ex)) {
-      continue;
+  reader_.read_directory(path, [&](std::string name,
+                                   const directory_entry &file,
+                                   const directory_entry_ex &file_ex) {
+    if (!parse::is_directory(file_ex)) {
+      action(name, file, file_ex);
     }
+    return true;
+  });
+}
 
-    action(name, file, file_ex);
+void mpeg_stream_writer::add_sector(const sector_data &sector) {
+  std::string stream_name;
+  if (parse::is_mpeg_audio_sector(sector)) {
+    stream_name =
+        (boost::format("audio_channel_%d.mpeg") %
+         static_cast<int>(parse::get_sector_header(sector).channel_num))
+            .str();
+  } else if (parse::is_mpeg_video_sector(sector)) {
+    stream_name =
+        (boost::format("video_channel_%d.mpeg") %
+         static_cast<int>(parse::get_sector_header(sector).channel_num))
+            .str();
+  } else {
+    // not interested in this sector, keep looking
+    // debug_dump_sector_header(parse::get_sector_header(sector));
+    return;
+  }
+
+  if (!media_found_) {
+    fs::create_directories(dest_directory_);
+    media_found_ = true;
+  }
+
+  // open new output stream if needed
+  if (out_streams_.find(stream_name) == out_streams_.end()) {
+    fs::path stream_path = dest_directory_;
+    stream_path.append(stream_name);
+
+    std::cerr << "    Copying " << stream_path << std::endl;
+
+    // this opens new output stream
+    out_streams_.emplace(stream_name,
+                         std::make_unique<file_sink>(stream_path.string()));
+  }
+
+  file_sink &out_stream = *out_streams_.at(stream_name);
+
+  // write chunk of media data to output
+  if (parse::is_mode2_form1_sector(sector)) {
+    out_stream.write(parse::get_mode2_form1_data<char>(sector),
+                     mode2_form1_data_size);
+  } else if (parse::is_mode2_form2_sector(sector)) {
+    out_stream.write(parse::get_mode2_form2_data<char>(sector),
+                     mode2_form2_data_size);
+  } else {
+    throw std::runtime_error("corrupted data");
   }
 }
 
-void cdi_helper::copy_mpeg_streams(const std::string &path,
-                                   const directory_entry &file,
-                                   const directory_entry_ex &file_ex,
-                                   const fs::path &dest_directory) {
-  std::unordered_map<std::string, std::ofstream> out_streams;
-  bool media_found = false;
-
-  reader_.scan_file(file, file_ex, [&](const sector_data &sector) {
-    std::string stream_name;
-    if (parse::is_mpeg_audio_sector(sector)) {
-      stream_name =
-          (boost::format("audio_channel_%d.mpeg") %
-           static_cast<int>(parse::get_sector_header(sector).channel_num))
-              .str();
-    } else if (parse::is_mpeg_video_sector(sector)) {
-      stream_name =
-          (boost::format("video_channel_%d.mpeg") %
-           static_cast<int>(parse::get_sector_header(sector).channel_num))
-              .str();
-    } else {
-      // not interested in this sector, keep looking
-      // debug_dump_sector_header(parse::get_sector_header(sector));
-      return true;
-    }
+void adpcm_audio_writer::add_sector(const sector_data &sector) {
+  if (!parse::is_adpcm_audio_sector(sector)) {
+    return;
+  }
+
+  const sector_header &header = parse::get_sector_header(sector);
 
-    if (!media_found) {
-      fs::create_directories(dest_directory);
-      media_found = true;
+  auto found = channels_.find(header.channel_num);
+  if (found == channels_.end()) {
+    if (!media_found_) {
+      fs::create_directories(dest_directory_);
+      media_found_ = true;
     }
 
-    // open new output stream if needed
-    if (out_streams.find(stream_name) == out_streams.end()) {
-      fs::path stream_path = dest_directory;
-      stream_path.append(stream_name);
+    fs::path wav_path = dest_directory_;
+    wav_path.append((boost::format("audio_channel_%d.wav") %
+                     static_cast<int>(header.channel_num))
+                        .str());
 
-      std::cerr << "    Copying " << stream_path << std::endl;
+    std::cerr << "    Copying " << wav_path << std::endl;
 
-      // this opens new output stream
-      out_streams.emplace(stream_name, stream_path.string());
+    const adpcm_decoder decoder(header.coding_info);
+    std::unique_ptr<channel> ch(new channel{
+        header.coding_info, decoder, {wav_path.string(), decoder.format()}});
+    found = channels_.emplace(header.channel_num, std::move(ch)).first;
+  }
+
+  channel &ch = *found->second;
+  // a WAV file has one format throughout
+  if (header.coding_info != ch.coding_info) {
+    return;
+  }
+
+  samples_.clear();
+  ch.decoder.decode_sector(parse::get_mode2_form2_data<uint8_t>(sector),
+                           samples_);
+  ch.out.write(samples_);
+}
+
+void dyuv_image_writer::add_sector(const sector_data &sector) {
+  if (!parse::is_video_sector(sector)) {
+    return;
+  }
+
+  const sector_header &header = parse::get_sector_header(sector);
+  if ((header.coding_info & coding_mask) != coding_DYUV) {
+    return;
+  }
+
+  std::vector<uint8_t> &dyuv_data = dyuv_datas_[header.channel_num];
+
+  if (parse::is_mode2_form1_sector(sector)) {
+    dyuv_data.insert(
+        dyuv_data.end(), parse::get_mode2_form1_data<char>(sector),
+        parse::get_mode2_form1_data<char>(sector) + mode2_form1_data_size);
+  } else if (parse::is_mode2_form2_sector(sector)) {
+    dyuv_data.insert(
+        dyuv_data.end(), parse::get_mode2_form2_data<char>(sector),
+        parse::get_mode2_form2_data<char>(sector) + mode2_form2_data_size);
+  } else {
+    throw std::runtime_error("corrupted data");
+  }
+
+  const size_t frame_size = options_.size.width * options_.size.height;
+  if (dyuv_data.size() >= frame_size) {
+    if (!media_found_) {
+      fs::create_directories(dest_directory_);
+      media_found_ = true;
     }
 
-    std::ofstream &out_stream = out_streams.at(stream_name);
+    fs::path png_path = dest_directory_;
+    png_path.append((boost::format("image_%d.png") % image_idx_++).str());
+
+    std::cerr << "    Copying " << png_path << std::endl;
 
-    // write chunk of media data to output
-    if (parse::is_mode2_form1_sector(sector)) {
-      out_stream.write(parse::get_mode2_form1_data<char>(sector),
-                       mode2_form1_data_size);
-    } else if (parse::is_mode2_form2_sector(sector)) {
-      out_stream.write(parse::get_mode2_form2_data<char>(sector),
-                       mode2_form2_data_size);
+    if (encoder_) {
+      encoder_->submit(std::move(dyuv_data), options_, png_path.string());
     } else {
-      throw std::runtime_error("corrupted data");
+      convert_dyuv_png(dyuv_data, options_, png_path.string());
     }
-    return true;
-  });
+    dyuv_data.clear();
+  }
 }
 
-void cdi_helper::copy_dyuv_images(const std::string &path,
-                                  const directory_entry &file,
-                                  const directory_entry_ex &file_ex,
-                                  const dyuv_options &options,
-                                  const fs::path &dest_directory) {
-  bool media_found = false;
-  std::unordered_map<uint8_t, std::vector<uint8_t>> dyuv_datas;
-  const size_t frame_size = options.size.width * options.size.height;
-  int image_idx = 0;
+void clut_image_writer::add_sector(const sector_data &sector) {
+  if (!parse::is_video_sector(sector)) {
+    return;
+  }
 
-  reader_.scan_file(file, file_ex, [&](const sector_data &sector) {
-    if (!parse::is_video_sector(sector)) {
-      return true;
-    }
+  const sector_header &header = parse::get_sector_header(sector);
+  if (!is_clut_coding(header.coding_info)) {
+    return;
+  }
 
-    const sector_header &header = parse::get_sector_header(sector);
-    if ((header.coding_info & coding_mask) != coding_DYUV) {
-      return true;
-    }
+  frame &f = frames_[header.channel_num];
+  // a change of coding starts a new frame
+  if (f.coding_info != header.coding_info) {
+    f.data.clear();
+    f.coding_info = header.coding_info;
+  }
 
-    std::vector<uint8_t> &dyuv_data = dyuv_datas[header.channel_num];
+  if (parse::is_mode2_form1_sector(sector)) {
+    f.data.insert(
+        f.data.end(), parse::get_mode2_form1_data<char>(sector),
+        parse::get_mode2_form1_data<char>(sector) + mode2_form1_data_size);
+  } else if (parse::is_mode2_form2_sector(sector)) {
+    f.data.insert(
+        f.data.end(), parse::get_mode2_form2_data<char>(sector),
+        parse::get_mode2_form2_data<char>(sector) + mode2_form2_data_size);
+  } else {
+    throw std::runtime_error("corrupted data");
+  }
 
-    if (parse::is_mode2_form1_sector(sector)) {
-      dyuv_data.insert(
-          dyuv_data.end(), parse::get_mode2_form1_data<char>(sector),
-          parse::get_mode2_form1_data<char>(sector) + mode2_form1_data_size);
-    } else if (parse::is_mode2_form2_sector(sector)) {
-      dyuv_data.insert(
-          dyuv_data.end(), parse::get_mode2_form2_data<char>(sector),
-          parse::get_mode2_form2_data<char>(sector) + mode2_form2_data_size);
-    } else {
-      throw std::runtime_error("corrupted data");
+  const size_t frame_bytes =
+      get_clut_frame_bytes(header.coding_info, options_.size);
+  if (frame_bytes ? f.data.size() >= frame_bytes
+                  : (header.submode & (submode::eor | submode::eof)) != 0) {
+    save_frame(f);
+  }
+}
+
+void clut_image_writer::save_frame(frame &f) {
+  if (!media_found_) {
+    fs::create_directories(dest_directory_);
+    media_found_ = true;
+  }
+
+  const std::string coding_name = clut_coding_name(f.coding_info);
+  fs::path png_path = dest_directory_;
+  png_path.append((boost::format("%s_image_%d.png") % coding_name %
+                   image_indices_[coding_name]++)
+                      .str());
+
+  std::cerr << "    Copying " << png_path << std::endl;
+
+  convert_clut_png(f.data, f.coding_info, options_.size, png_path.string());
+  f.data.clear();
+}
+
+void rgb555_image_writer::plane::append(const uint8_t *bytes, size_t size) {
+  // drop paired bytes once they make up half of the buffer
+  if (position && position >= data.size() / 2) {
+    data.erase(data.begin(), data.begin() + position);
+    position = 0;
+  }
+  data.insert(data.end(), bytes, bytes + size);
+}
+
+void rgb555_image_writer::plane::consume(size_t size) {
+  position += size;
+  if (position == data.size()) {
+    clear();
+  }
+}
+
+void rgb555_image_writer::plane::clear() {
+  data.clear();
+  position = 0;
+}
+
+void rgb555_image_writer::add_sector(const sector_data &sector) {
+  if (!parse::is_video_sector(sector)) {
+    return;
+  }
+
+  const sector_header &header = parse::get_sector_header(sector);
+  const uint8_t coding = header.coding_info & coding_mask;
+  if (coding != coding_RGB555_lower && coding != coding_RGB555_upper) {
+    return;
+  }
+
+  channel &ch = channels_[header.channel_num];
+  plane &p = coding == coding_RGB555_lower ? ch.lower : ch.upper;
+
+  const uint8_t *data;
+  size_t size;
+  if (parse::is_mode2_form1_sector(sector)) {
+    data = parse::get_mode2_form1_data<uint8_t>(sector);
+    size = mode2_form1_data_size;
+  } else if (parse::is_mode2_form2_sector(sector)) {
+    data = parse::get_mode2_form2_data<uint8_t>(sector);
+    size = mode2_form2_data_size;
+  } else {
+    throw std::runtime_error("corrupted data");
+  }
+
+  // as with DYUV, the rest of the sector that completes a frame is padding
+  const size_t frame_pixels = options_.size.width * options_.size.height;
+  const size_t used = std::min(size, frame_pixels - p.received);
+  p.append(data, used);
+  p.received += used;
+  if (p.received == frame_pixels) {
+    p.received = 0;
+  }
+
+  pair_planes(ch);
+}
+
+void rgb555_image_writer::pair_planes(channel &ch) {
+  const size_t width = options_.size.width;
+  const size_t height = options_.size.height;
+  const size_t frame_pixels = width * height;
+
+  for (;;) {
+    const size_t count =
+        std::min({ch.lower.available(), ch.upper.available(),
+                  frame_pixels - ch.merged});
+    if (count == 0) {
+      break;
     }
 
-    if (dyuv_data.size() >= frame_size) {
-      if (!media_found) {
-        fs::create_directories(dest_directory);
-        media_found = true;
+    ch.rgb_data.resize(frame_pixels * 3);
+    merge_rgb555(&ch.lower.data[ch.lower.position],
+                 &ch.upper.data[ch.upper.position], count,
+                 &ch.rgb_data[ch.merged * 3]);
+    ch.lower.consume(count);
+    ch.upper.consume(count);
+    ch.merged += count;
+
+    if (ch.merged == frame_pixels) {
+      if (!media_found_) {
+        fs::create_directories(dest_directory_);
+        media_found_ = true;
       }
 
-      fs::path png_path = dest_directory;
-      png_path.append((boost::format("image_%d.png") % image_idx++).str());
+      fs::path png_path = dest_directory_;
+      png_path.append(
+          (boost::format("rgb555_image_%d.png") % image_idx_++).str());
 
       std::cerr << "    Copying " << png_path << std::endl;
 
-      convert_dyuv_png(dyuv_data, options, png_path.string());
-      dyuv_data.clear();
+      write_png_file(ch.rgb_data, width, height, png_path.string());
+      ch.merged = 0;
     }
+  }
+
+  // the other plane fell more than a frame behind and is not coming
+  if (ch.lower.available() > frame_pixels ||
+      ch.upper.available() > frame_pixels) {
+    ch.lower = {};
+    ch.upper = {};
+    ch.merged = 0;
+  }
+}
+
+template <typename MakeWriter, typename Wanted>
+void cdi_helper::copy_media(MakeWriter make_writer, const Wanted &wanted) {
+  std::vector<directory_entry_2> files;
+  std::vector<fs::path> media_directories;
+
+  for (const auto &path : paths_) {
+    enum_directory(path, [&](const std::string &name,
+                             const directory_entry &file,
+                             const directory_entry_ex &file_ex) {
+      files.emplace_back(file, file_ex);
+      // Add .MEDIA suffix to stream directory name to prevent overwriting an
+      // actual file
+      media_directories.push_back(
+          init_destination(path + "/" + name + ".MEDIA", false));
+    });
+  }
+
+  // a writer exists only while its file is being read
+  std::vector<decltype(make_writer(fs::path()))> writers(files.size());
+  reader_.scan_files(
+      files,
+      [&](size_t index, const sector_data &sector, const char *, size_t) {
+        if (!writers[index]) {
+          writers[index] = make_writer(media_directories[index]);
+        }
+        writers[index]->add_sector(sector);
+        return true;
+      },
+      [&](size_t index, bool) { writers[index].reset(); }, wanted);
+}
+
+void cdi_helper::copy_mpeg_streams() {
+  copy_media(
+      [](const fs::path &directory) {
+        return std::make_unique<mpeg_stream_writer>(directory);
+      },
+      [](const sector_header &header) {
+        return filters::mpeg_audio(header) || filters::mpeg_video(header);
+      });
+}
 
+void cdi_helper::copy_adpcm_audio() {
+  copy_media(
+      [](const fs::path &directory) {
+        return std::make_unique<adpcm_audio_writer>(directory);
+      },
+      [](const sector_header &header) {
+        return filters::audio(header) && filters::form2(header) &&
+               !filters::mpeg_audio(header);
+      });
+}
+
+void cdi_helper::copy_clut_images(const dyuv_options &options) {
+  copy_media(
+      [&](const fs::path &directory) {
+        return std::make_unique<clut_image_writer>(options, directory);
+      },
+      [](const sector_header &header) {
+        return filters::video(header) && is_clut_coding(header.coding_info);
+      });
+}
+
+void cdi_helper::copy_rgb555_images(const dyuv_options &options) {
+  copy_media(
+      [&](const fs::path &directory) {
+        return std::make_unique<rgb555_image_writer>(options, directory);
+      },
+      filters::rgb555);
+}
+
+void cdi_helper::copy_dyuv_images(const dyuv_options &options,
+                                  dyuv_encoder_pool *encoder /*= nullptr*/) {
+  copy_media(
+      [&](const fs::path &directory) {
+        return std::make_unique<dyuv_image_writer>(options, directory,
+                                                   encoder);
+      },
+      filters::dyuv);
+}
+
+void cdi_helper::copy_files(unsigned int threads /*= 1*/) {
+  std::vector<directory_entry_2> files;
+  std::vector<fs::path> destinations;
+
+  for (const auto &path : paths_) {
+    std::cout << "/" << path << std::endl;
+
+    const fs::path subdirectory = init_destination(path);
+
+    enum_directory(path, [&](const std::string &name,
+                             const directory_entry &file,
+                             const directory_entry_ex &file_ex) {
+      files.emplace_back(file, file_ex);
+      destinations.push_back(subdirectory);
+      destinations.back().append(name);
+    });
+
+    std::cout << std::endl;
+  }
+
+  std::vector<std::unique_ptr<file_sink>> streams(files.size());
+
+  const auto handler = [&](size_t index, const sector_data &, const char *data,
+                           size_t size) {
+    auto &stream_out = streams[index];
+    if (!stream_out) {
+      std::cerr << "    Copying " << destinations[index].string()
+                << std::endl;
+      stream_out = std::make_unique<file_sink>(
+          destinations[index].string(),
+          util::swap_byte_order(files[index].first.file_size));
+    }
+    stream_out->write(data, size);
     return true;
-  });
+  };
+
+  const auto done = [&](size_t index, bool completed) {
+    const bool opened = streams[index] != nullptr;
+    const bool written = opened && streams[index]->close();
+    streams[index].reset();
+    if (opened && (!completed || !written)) {
+      fs::remove(destinations[index]);
+    }
+  };
+
+  if (threads > 1) {
+    // descrambling is the heavier stage here
+    pipeline_options pipeline;
+    pipeline.writers = 1;
+    pipeline.workers = std::max(1u, threads - pipeline.writers);
+    reader_.scan_files_parallel(files, handler, done, pipeline);
+  } else {
+    reader_.scan_files(files, handler, done);
+  }
+}
+
+void cdi_helper::copy_all(const dyuv_options &options,
+                          unsigned int threads /*= 1*/) {
+  struct file_job {
+    fs::path destination;
+    fs::path media_directory;
+    std::unique_ptr<file_sink> file_out;
+    std::unique_ptr<mpeg_stream_writer> mpegs;
+    std::unique_ptr<adpcm_audio_writer> audio;
+    std::unique_ptr<dyuv_image_writer> images;
+    std::unique_ptr<clut_image_writer> clut_images;
+    std::unique_ptr<rgb555_image_writer> rgb555_images;
+  };
+
+  std::vector<directory_entry_2> files;
+  std::vector<file_job> jobs;
+
+  for (const auto &path : paths_) {
+    const fs::path subdirectory = init_destination(path);
+
+    enum_directory(path, [&](const std::string &name,
+                             const directory_entry &file,
+                             const directory_entry_ex &file_ex) {
+      files.emplace_back(file, file_ex);
+      jobs.emplace_back();
+      jobs.back().destination = subdirectory;
+      jobs.back().destination.append(name);
+      // Add .MEDIA suffix to stream directory name to prevent overwriting an
+      // actual file
+      jobs.back().media_directory =
+          init_destination(path + "/" + name + ".MEDIA", false);
+    });
+  }
+
+  const auto handler = [&](size_t index, const sector_data &sector,
+                           const char *data, size_t size) {
+    file_job &job = jobs[index];
+    if (!job.file_out) {
+      std::cerr << "    Copying " << job.destination.string() << std::endl;
+      job.file_out = std::make_unique<file_sink>(
+          job.destination.string(),
+          util::swap_byte_order(files[index].first.file_size));
+      job.mpegs = std::make_unique<mpeg_stream_writer>(job.media_directory);
+      job.audio = std::make_unique<adpcm_audio_writer>(job.media_directory);
+      job.images =
+          std::make_unique<dyuv_image_writer>(options, job.media_directory);
+      job.clut_images =
+          std::make_unique<clut_image_writer>(options, job.media_directory);
+      job.rgb555_images =
+          std::make_unique<rgb555_image_writer>(options, job.media_directory);
+    }
+    job.file_out->write(data, size);
+    job.mpegs->add_sector(sector);
+    job.audio->add_sector(sector);
+    job.images->add_sector(sector);
+    job.clut_images->add_sector(sector);
+    job.rgb555_images->add_sector(sector);
+    return true;
+  };
+
+  const auto done = [&](size_t index, bool completed) {
+    file_job &job = jobs[index];
+    const bool opened = job.file_out != nullptr;
+    const bool written = opened && job.file_out->close();
+    job.file_out.reset();
+    job.mpegs.reset();
+    job.audio.reset();
+    job.images.reset();
+    job.clut_images.reset();
+    job.rgb555_images.reset();
+    if (opened && (!completed || !written)) {
+      fs::remove(job.destination);
+    }
+  };
+
+  if (threads > 1) {
+    // writers do the compression and file output, so they get the larger share
+    pipeline_options pipeline;
+    pipeline.workers = std::max(1u, threads / 3);
+    pipeline.writers = std::max(1u, threads - pipeline.workers);
+    reader_.scan_files_parallel(files, handler, done, pipeline);
+  } else {
+    reader_.scan_files(files, handler, done);
+  }
 }
@@ -8,16 +8,144 @@
 
 #pragma once
 
+#include "audio.h"
+#include "cdi_lib/file_sink.h"
 #include "cdi_lib/parse.h"
 
 #include <boost/filesystem.hpp>
 
 struct dyuv_options;
+class dyuv_encoder_pool;
+
+// Writes each MPEG audio and video channel of a file to its own stream
+class mpeg_stream_writer {
+public:
+  mpeg_stream_writer(boost::filesystem::path dest_directory)
+      : dest_directory_(dest_directory) {}
+
+  void add_sector(const cd_i::sector_data &sector);
+
+private:
+  boost::filesystem::path dest_directory_;
+  bool media_found_ = false;
+  std::unordered_map<std::string, std::unique_ptr<cd_i::file_sink>>
+      out_streams_;
+};
+
+// Decodes each ADPCM audio channel of a file to its own WAV file
+class adpcm_audio_writer {
+public:
+  adpcm_audio_writer(boost::filesystem::path dest_directory)
+      : dest_directory_(dest_directory) {}
+
+  void add_sector(const cd_i::sector_data &sector);
+
+private:
+  struct channel {
+    uint8_t coding_info;
+    adpcm_decoder decoder;
+    wav_writer out;
+  };
+
+  boost::filesystem::path dest_directory_;
+  bool media_found_ = false;
+  std::unordered_map<uint8_t, std::unique_ptr<channel>> channels_;
+  std::vector<int16_t> samples_;
+};
+
+// Assembles DYUV frames per channel and saves each as PNG, on the encoder
+// pool if one is given
+class dyuv_image_writer {
+public:
+  dyuv_image_writer(const dyuv_options &options,
+                    boost::filesystem::path dest_directory,
+                    dyuv_encoder_pool *encoder = nullptr)
+      : options_(options), dest_directory_(dest_directory), encoder_(encoder) {}
+
+  void add_sector(const cd_i::sector_data &sector);
+
+private:
+  const dyuv_options &options_;
+  boost::filesystem::path dest_directory_;
+  dyuv_encoder_pool *encoder_;
+  bool media_found_ = false;
+  std::unordered_map<uint8_t, std::vector<uint8_t>> dyuv_datas_;
+  int image_idx_ = 0;
+};
+
+// Assembles CLUT and run-length coded frames per channel and saves each as an
+// indexed PNG
+class clut_image_writer {
+public:
+  clut_image_writer(const dyuv_options &options,
+                    boost::filesystem::path dest_directory)
+      : options_(options), dest_directory_(dest_directory) {}
+
+  void add_sector(const cd_i::sector_data &sector);
+
+private:
+  struct frame {
+    uint8_t coding_info = 0;
+    std::vector<uint8_t> data;
+  };
+
+  void save_frame(frame &f);
+
+private:
+  const dyuv_options &options_;
+  boost::filesystem::path dest_directory_;
+  bool media_found_ = false;
+  std::unordered_map<uint8_t, frame> frames_;
+  std::unordered_map<std::string, int> image_indices_;
+};
+
+// Pairs the lower and upper planes of RGB555 frames per channel as their
+// sectors arrive and saves each frame as PNG. Only the part of one plane that
+// is ahead of the other is buffered, at most a frame's worth.
+class rgb555_image_writer {
+public:
+  rgb555_image_writer(const dyuv_options &options,
+                      boost::filesystem::path dest_directory)
+      : options_(options), dest_directory_(dest_directory) {}
+
+  void add_sector(const cd_i::sector_data &sector);
+
+private:
+  struct plane {
+    std::vector<uint8_t> data;
+    // bytes before this are already paired
+    size_t position = 0;
+    // bytes of the plane's current frame received so far
+    size_t received = 0;
+
+    size_t available() const { return data.size() - position; }
+    void append(const uint8_t *bytes, size_t size);
+    void consume(size_t size);
+    void clear();
+  };
+
+  struct channel {
+    plane lower;
+    plane upper;
+    std::vector<uint8_t> rgb_data;
+    size_t merged = 0;
+  };
+
+  void pair_planes(channel &ch);
+
+private:
+  const dyuv_options &options_;
+  boost::filesystem::path dest_directory_;
+  bool media_found_ = false;
+  std::unordered_map<uint8_t, channel> channels_;
+  int image_idx_ = 0;
+};
 
 class cdi_helper {
 public:
-  cdi_helper(std::string in_path, std::string out_path = "")
-      : reader_(in_path), out_path_(out_path) {}
+  cdi_helper(std::string in_path, std::string out_path = "",
+             cd_i::reader_options reader_options = {})
+      : reader_(in_path, reader_options), out_path_(out_path) {}
 
   boost::filesystem::path init_destination(std::string subdirectory_name = "",
                                            bool create = true);
@@ -32,19 +160,35 @@ public:
       std::function<void(const std::string &, const cd_i::directory_entry &,
                          const cd_i::directory_entry_ex &)>);
 
-  void copy_mpeg_streams(const std::string &disc_path,
-                         const cd_i::directory_entry &file,
-                         const cd_i::directory_entry_ex &file_ex,
-                         const boost::filesystem::path &dest_directory);
+  // Each of these writes one kind of media from the files of all disc paths
+  // to a .MEDIA directory per file, in a single pass over the disc
+  void copy_mpeg_streams();
+  void copy_adpcm_audio();
+  void copy_clut_images(const dyuv_options &options);
+  void copy_rgb555_images(const dyuv_options &options);
+  void copy_dyuv_images(const dyuv_options &options,
+                        dyuv_encoder_pool *encoder = nullptr);
+
+  // Copies the files of all disc paths in a single pass over the disc, so that
+  // interleaved files are read only once; on a pipeline of the given number
+  // of threads if more than one
+  void copy_files(unsigned int threads = 1);
+
+  // Copies files, MPEG streams, ADPCM audio and all supported images in a
+  // single pass over the disc, on a pipeline of the given number of threads
+  // if more than one
+  void copy_all(const dyuv_options &options, unsigned int threads = 1);
 
-  void copy_dyuv_images(const std::string &disc_path,
-                        const cd_i::directory_entry &file,
-                        const cd_i::directory_entry_ex &file_ex,
-                        const dyuv_options &options,
-                        const boost::filesystem::path &dest_directory);
+  void report_skipped_data() const;
 
   cd_i::disc_structure_reader &reader() { return reader_; }
 
+private:
+  // Feeds the wanted sectors of every file to a writer made for it by
+  // make_writer from its .MEDIA directory
+  template <typename MakeWriter, typename Wanted>
+  void copy_media(MakeWriter make_writer, const Wanted &wanted);
+
 private:
   std::string out_path_;
   std::vector<std::string> paths_;
@@ -7,6 +7,7 @@
 //
 
 #include "actions.h"
+#include "batch.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
@@ -32,7 +33,7 @@ struct command_description {
   command_handler handler;
 };
 
-const std::array<command_description, 5> commands = {{
+const std::array<command_description, 8> commands = {{
     {"print,p", "Print all files and directories in CD-i track image",
      &print_filesystem},
     {"extract-files,x",
@@ -41,8 +42,15 @@ const std::array<command_description, 5> commands = {{
      &copy_filesystem},
     {"extract-mpegs,m", "Copy real-time MPEG streams from CD-i track image",
      &copy_mpeg_streams},
+    {"extract-audio,u", "Decode ADPCM audio from CD-i track image to WAV",
+     &copy_adpcm_audio},
     {"extract-dyuv,d", "Copy DYUV images from CD-i track image",
      &copy_dyuv_images},
+    {"extract-clut,i",
+     "Copy CLUT and run-length coded images from CD-i track image",
+     &copy_clut_images},
+    {"extract-rgb555,r", "Copy RGB555 images from CD-i track image",
+     &copy_rgb555_images},
     {"extract-all,a", "Copy all supported formats from CD-i track image",
      &copy_all},
 }};
@@ -51,6 +59,8 @@ command_handler_t action;
 std::string input_path;
 std::string output_path;
 action_options options;
+bool batch_mode = false;
+batch_options batch;
 
 struct dyuv_size_t {
   dyuv_size value;
@@ -60,9 +70,6 @@ struct dyuv_seed_t {
   dyuv_seed value;
 };
 
-constexpr std::array<dyuv_size, 3> supported_dyuv_sizes = {
-    {{384, 280}, {384, 240}, {360, 240}}};
-
 std::string dyuv_size_str(const dyuv_size &size) {
   return (boost::format("%lu:%lu") % size.width % size.height).str();
 }
@@ -154,13 +161,25 @@ bool parse_options(int argc, const char *argv[]) {
   dyuv_size_t size;
   dyuv_seed_t seed;
   bool no_interpolation;
+  bool no_mmap;
+  bool huge_pages;
+  bool resync;
+  bool use_index;
+  unsigned int threads = 0;
+  unsigned int readers_per_device = batch.readers_per_device;
 
   const std::string dyuv_size_description =
-      std::string("DYUV dimensions (supported: ") + supported_dyuv_sizes_str() +
+      std::string("DYUV, RGB555 and normal resolution CLUT image dimensions "
+                  "(supported: ") +
+      supported_dyuv_sizes_str() +
       ", default: " + dyuv_size_str(supported_dyuv_sizes.front()) + ")";
   const std::string dyuv_seed_description =
       std::string("DYUV initial vector (default: ") +
       dyuv_seed_str(seed.value) + ")";
+  const std::string readers_description =
+      std::string("images read at once from one device with --batch "
+                  "(default: ") +
+      std::to_string(batch.readers_per_device) + ")";
 
   po::options_description global_options("Options");
   global_options.add_options()("help,h", po::bool_switch(&usage),
@@ -170,7 +189,24 @@ bool parse_options(int argc, const char *argv[]) {
                                      po::value<dyuv_seed_t>(&seed),
                                      dyuv_seed_description.c_str())(
       "dyuv-no-interpolation,", po::bool_switch(&no_interpolation),
-      "disable DYUV interpolation");
+      "disable DYUV interpolation")("no-mmap,", po::bool_switch(&no_mmap),
+                                    "read image through a stream instead of "
+                                    "mapping it into memory")(
+      "huge-pages,", po::bool_switch(&huge_pages),
+      "back the image mapping with huge pages where supported")(
+      "resync,", po::bool_switch(&resync),
+      "skip damaged regions of the image instead of stopping")(
+      "index,", po::bool_switch(&use_index),
+      "keep a sector index next to the image (<input_path>.cdxi) and use it "
+      "to skip unneeded sectors")(
+      "threads,j", po::value<unsigned int>(&threads),
+      "threads for extract-files, extract-dyuv and extract-all, or images "
+      "extracted at once with --batch (default: one per core)")(
+      "batch,", po::bool_switch(&batch_mode),
+      "treat <input_path> as a glob pattern or a file listing one image per "
+      "line and extract each image into a directory named after it")(
+      "readers-per-device,", po::value<unsigned int>(&readers_per_device),
+      readers_description.c_str());
 
   po::options_description hidden_options;
   hidden_options.add_options()("command", po::value(&action)->required(),
@@ -211,11 +247,18 @@ bool parse_options(int argc, const char *argv[]) {
     return false;
   }
 
+  options.reader.use_mmap = !no_mmap;
+  options.reader.huge_pages = huge_pages;
+  options.reader.resync = resync;
+  options.reader.use_index = use_index;
+  options.threads = threads;
+  batch.threads = threads;
+  batch.readers_per_device = readers_per_device;
   options.dyuv.size = size.value;
   options.dyuv.seed = seed.value;
   options.dyuv.interpolate = !no_interpolation;
 
-  if (output_path.empty()) {
+  if (output_path.empty() && !batch_mode) {
     boost::filesystem::path path(input_path);
     output_path = path.parent_path().string();
   }
@@ -229,5 +272,8 @@ int main(int argc, const char *argv[]) {
     return 1;
   }
 
+  if (batch_mode) {
+    return run_batch(action.value, input_path, output_path, options, batch);
+  }
   return action.value(input_path, output_path, options);
 }
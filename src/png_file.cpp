@@ -0,0 +1,90 @@
+//
+//  png_file.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "png_file.h"
+
+#include "cdi_lib/file_sink.h"
+
+#include <png.h>
+
+static void write_png_data(png_structp png_ptr, png_bytep data,
+                           png_size_t size) {
+  static_cast<cd_i::file_sink *>(png_get_io_ptr(png_ptr))->write(data, size);
+}
+
+// the sink flushes on close
+static void flush_png_data(png_structp) {}
+
+static bool write_png_rows(uint8_t *data, const size_t width,
+                           const size_t height, const size_t row_size,
+                           int color_type, int bit_depth,
+                           const png_palette *palette, int transforms,
+                           const std::string &path) {
+  cd_i::file_sink sink(path);
+  if (sink.failed()) {
+    return false;
+  }
+
+  auto png_ptr =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+  if (!png_ptr) {
+    return false;
+  }
+
+  auto info_ptr = png_create_info_struct(png_ptr);
+  if (!info_ptr) {
+    png_destroy_write_struct(&png_ptr, NULL);
+    return false;
+  }
+
+  png_set_IHDR(png_ptr, info_ptr, static_cast<png_uint_32>(width),
+               static_cast<png_uint_32>(height), bit_depth, color_type,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+
+  if (palette) {
+    std::vector<png_color> colors;
+    for (const auto &entry : *palette) {
+      colors.push_back({entry[0], entry[1], entry[2]});
+    }
+    png_set_PLTE(png_ptr, info_ptr, colors.data(),
+                 static_cast<int>(colors.size()));
+  }
+
+  auto row_pointers =
+      (uint8_t **)png_malloc(png_ptr, height * sizeof(uint8_t *));
+  for (size_t y = 0; y < height; y++) {
+    row_pointers[y] = &data[y * row_size];
+  }
+
+  png_set_write_fn(png_ptr, &sink, &write_png_data, &flush_png_data);
+  png_set_rows(png_ptr, info_ptr, row_pointers);
+  png_write_png(png_ptr, info_ptr, transforms, NULL);
+  png_free(png_ptr, row_pointers);
+  png_destroy_write_struct(&png_ptr, &info_ptr);
+
+  return sink.close();
+}
+
+bool write_png_file(std::vector<uint8_t> &rgb_data, const size_t width,
+                    const size_t height, const std::string &path) {
+  return write_png_rows(rgb_data.data(), width, height, width * 3,
+                        PNG_COLOR_TYPE_RGB, 8, nullptr,
+                        PNG_TRANSFORM_IDENTITY, path);
+}
+
+bool write_indexed_png_file(std::vector<uint8_t> &indices, const size_t width,
+                            const size_t height, const png_palette &palette,
+                            int bit_depth, const std::string &path) {
+  // libpng packs the one-byte indices down to bit_depth
+  return write_png_rows(indices.data(), width, height, width,
+                        PNG_COLOR_TYPE_PALETTE, bit_depth, &palette,
+                        bit_depth < 8 ? PNG_TRANSFORM_PACKING
+                                      : PNG_TRANSFORM_IDENTITY,
+                        path);
+}
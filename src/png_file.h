@@ -0,0 +1,25 @@
+//
+//  png_file.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+using png_palette = std::vector<std::array<uint8_t, 3>>;
+
+// 24-bit RGB, three bytes per pixel
+bool write_png_file(std::vector<uint8_t> &rgb_data, size_t width,
+                    size_t height, const std::string &path);
+
+// One palette index per pixel; indices are packed into bit_depth bits
+// (1, 2, 4 or 8) in the file
+bool write_indexed_png_file(std::vector<uint8_t> &indices, size_t width,
+                            size_t height, const png_palette &palette,
+                            int bit_depth, const std::string &path);
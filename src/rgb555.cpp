@@ -0,0 +1,125 @@
+//
+//  rgb555.cpp
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#include "rgb555.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RGB555_HAS_X86_SIMD 1
+#endif
+
+namespace {
+
+// 5-bit component to 8 bits, replicating the top bits into the low ones
+inline uint8_t expand5(unsigned int value) {
+  return static_cast<uint8_t>((value << 3) | (value >> 2));
+}
+
+#ifdef RGB555_HAS_X86_SIMD
+
+constexpr size_t rgb555_block = 16;
+
+__attribute__((target("ssse3"))) inline __m128i
+expand5_epi8(__m128i value) {
+  // byte-wise (value << 3) | (value >> 2) on 16-bit shifts
+  const __m128i high = _mm_and_si128(_mm_slli_epi16(value, 3),
+                                     _mm_set1_epi8(static_cast<char>(0xf8)));
+  const __m128i low =
+      _mm_and_si128(_mm_srli_epi16(value, 2), _mm_set1_epi8(0x07));
+  return _mm_or_si128(high, low);
+}
+
+__attribute__((target("ssse3"))) void
+merge_rgb555_ssse3(const uint8_t *lower, const uint8_t *upper, size_t pixels,
+                   uint8_t *rgb) {
+  const __m128i mask5 = _mm_set1_epi8(0x1f);
+
+  // byte i of output block k takes pixel (16k + i) / 3 from the plane that
+  // matches (16k + i) % 3; -1 leaves the byte zero
+  const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1,
+                                   4, -1, -1, 5);
+  const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1,
+                                   -1, 4, -1, -1);
+  const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3,
+                                   -1, -1, 4, -1);
+  const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9,
+                                   -1, -1, 10, -1);
+  const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1,
+                                   9, -1, -1, 10);
+  const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1,
+                                   -1, 9, -1, -1);
+  const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14,
+                                   -1, -1, 15, -1, -1);
+  const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1,
+                                   14, -1, -1, 15, -1);
+  const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1,
+                                   -1, 14, -1, -1, 15);
+
+  size_t i = 0;
+  for (; i + rgb555_block <= pixels; i += rgb555_block) {
+    const __m128i lo =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(lower + i));
+    const __m128i hi =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(upper + i));
+
+    const __m128i b = expand5_epi8(_mm_and_si128(lo, mask5));
+    // mask before shifting so that no bits cross into the neighboring byte
+    const __m128i g = expand5_epi8(_mm_or_si128(
+        _mm_and_si128(_mm_srli_epi16(lo, 5), _mm_set1_epi8(0x07)),
+        _mm_slli_epi16(_mm_and_si128(hi, _mm_set1_epi8(0x03)), 3)));
+    const __m128i r = expand5_epi8(
+        _mm_and_si128(_mm_srli_epi16(hi, 2), mask5));
+
+    uint8_t *out = rgb + i * 3;
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r0),
+                                               _mm_shuffle_epi8(g, g0)),
+                                  _mm_shuffle_epi8(b, b0)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 16),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r1),
+                                               _mm_shuffle_epi8(g, g1)),
+                                  _mm_shuffle_epi8(b, b1)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 32),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r2),
+                                               _mm_shuffle_epi8(g, g2)),
+                                  _mm_shuffle_epi8(b, b2)));
+  }
+
+  merge_rgb555_scalar(lower + i, upper + i, pixels - i, rgb + i * 3);
+}
+
+bool has_ssse3() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("ssse3");
+}
+
+#endif
+
+} // namespace
+
+void merge_rgb555_scalar(const uint8_t *lower, const uint8_t *upper,
+                         size_t pixels, uint8_t *rgb) {
+  for (size_t i = 0; i < pixels; ++i) {
+    const unsigned int pixel = lower[i] | (upper[i] << 8);
+    *rgb++ = expand5((pixel >> 10) & 0x1f);
+    *rgb++ = expand5((pixel >> 5) & 0x1f);
+    *rgb++ = expand5(pixel & 0x1f);
+  }
+}
+
+void merge_rgb555(const uint8_t *lower, const uint8_t *upper, size_t pixels,
+                  uint8_t *rgb) {
+#ifdef RGB555_HAS_X86_SIMD
+  static const bool ssse3 = has_ssse3();
+  if (ssse3) {
+    merge_rgb555_ssse3(lower, upper, pixels, rgb);
+    return;
+  }
+#endif
+  merge_rgb555_scalar(lower, upper, pixels, rgb);
+}
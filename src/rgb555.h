@@ -0,0 +1,24 @@
+//
+//  rgb555.h
+//  CD-i Extract
+//
+//  Created by Andrei Chtcherbatchenko on 8/11/20.
+//  Copyright © 2020 Andrei Chtcherbatchenko. All rights reserved.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// RGB555 images come in two planes of one byte per pixel: the lower plane
+// holds the low byte and the upper plane the high byte of each 16-bit pixel
+// (bit 15 unused, then 5 bits each of red, green and blue).
+//
+// Merges pixels from both planes into 24-bit RGB. Uses a SIMD kernel when
+// the CPU supports one, output is identical to merge_rgb555_scalar.
+void merge_rgb555(const uint8_t *lower, const uint8_t *upper, size_t pixels,
+                  uint8_t *rgb);
+
+void merge_rgb555_scalar(const uint8_t *lower, const uint8_t *upper,
+                         size_t pixels, uint8_t *rgb);